@@ -0,0 +1,292 @@
+//
+// Created by giacomo on 28/02/26.
+//
+
+#include "headers/Boids_engine.h"
+#include "headers/Frame_stats.h"
+#include "headers/AOS_helper.h"
+#include "headers/AOS_helper_SIMD.h"
+#include "headers/SOA_helper.h"
+#include "headers/SOA_helper_SIMD.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <type_traits>
+#include <vector>
+#include <omp.h>
+
+/**
+ * Benchmark sweep in a single process, instead of one launch of an executable per point
+ * (scripts/run_benchmark.py calls it once with the whole matrix).
+ * The matrix is layouts x N x threads (strong scaling) plus, with --weak <n>, a weak scaling series
+ * with n boids per thread (its points with an N of --N are the strong ones, run only once).
+ * Every layout runs with the policy and the default neighbour search of its executable.
+ * A point is allocated once; every repeat restarts the flock from its own seed (seed + repeat,
+ * like independent runs) in the same memory, runs --warmup frames and then measures --frames frames.
+ * Every repeat is a row of one csv, written with its header when the sweep starts and flushed row by row,
+ * so an interrupted sweep still leaves a well-formed file. The settings of the sweep are columns too
+ * (frames, warmup, weak = boids per thread of the weak series, 0 without it), no comment lines.
+ * The other options (--kernel, --schedule, --block, --params, --counters, ...) are the ones of the
+ * executables and apply to every point.
+ **/
+
+struct SweepConfig {
+
+    std::vector<std::string> layouts = {"AOS", "AOS_parallel_SIMD", "SOA", "SOA_parallel_SIMD"};
+    std::vector<int> N = {1500, 3000, 6000, 9000, 12000};
+    std::vector<int> threads = {1, 2, 4, 8};
+    int weak = 0;           // boids per thread of the weak scaling series, 0 = no series
+    int repeats = 6;
+    int frames = 300;
+    int warmup = 10;
+    std::string neighbours; // empty = the default of every executable
+    std::string csv = "sweep.csv";
+    std::vector<std::string> engine_args; // everything else, parsed by Config
+
+    //Parsing params passed via command line, lists are comma separated
+    void parse(int argc, char* argv[]) {
+        for (int i = 1; i < argc; ++i) {
+            std::string arg = argv[i];
+            if (arg == "--layouts" && i + 1 < argc) {
+                layouts = split(argv[++i]);
+            } else if (arg == "--N" && i + 1 < argc) {
+                N.clear();
+                for (const std::string& v : split(argv[++i]))
+                    N.push_back(std::stoi(v));
+            } else if (arg == "--threads" && i + 1 < argc) {
+                threads.clear();
+                for (const std::string& v : split(argv[++i]))
+                    threads.push_back(std::stoi(v));
+            } else if (arg == "--weak" && i + 1 < argc) {
+                weak = std::stoi(argv[++i]);
+            } else if (arg == "--repeats" && i + 1 < argc) {
+                repeats = std::stoi(argv[++i]);
+            } else if (arg == "--frames" && i + 1 < argc) {
+                frames = std::stoi(argv[++i]);
+            } else if (arg == "--warmup" && i + 1 < argc) {
+                warmup = std::stoi(argv[++i]);
+            } else if (arg == "--neighbours" && i + 1 < argc) {
+                neighbours = argv[++i];
+            } else if (arg == "--csv" && i + 1 < argc) {
+                csv = argv[++i];
+            }
+            else {
+                engine_args.push_back(arg);
+            }
+        }
+    }
+
+    static std::vector<std::string> split(const std::string& list) {
+        std::vector<std::string> values;
+        std::stringstream ss(list);
+        std::string item;
+        while (std::getline(ss, item, ','))
+            values.push_back(item);
+        return values;
+    }
+};
+
+struct SweepPoint {
+    const char* scaling; // "strong" or "weak"
+    int N;
+    int threads;
+};
+
+inline std::vector<SweepPoint> sweep_points(const SweepConfig& sc) {
+    std::vector<SweepPoint> points;
+    for (int N : sc.N) {
+        for (int threads : sc.threads)
+            points.push_back({"strong", N, threads});
+    }
+    // A weak point with an N of the strong series is already in the matrix: not run twice, the rows
+    // of the weak series are the "weak" ones plus the strong ones with N = weak * threads
+    if (sc.weak > 0) {
+        for (int threads : sc.threads) {
+            if (std::find(sc.N.begin(), sc.N.end(), sc.weak * threads) == sc.N.end())
+                points.push_back({"weak", sc.weak * threads, threads});
+        }
+    }
+    return points;
+}
+
+// The neighbour search of the executable when --neighbours is not given
+inline std::string default_neighbours(const std::string& layout) {
+    return layout == "SOA_parallel_SIMD" ? "grid" : "all";
+}
+
+inline void write_sweep_header(std::ofstream& out) {
+    out << "layout,kernel,neighbours,scaling,N,threads,repeat,seed,frames,warmup,weak,time_ms,mean_us,min_us,p50_us,p90_us,p99_us,max_us";
+    for (const char* name : PERF_COUNTER_NAMES)
+        out << "," << name;
+    out << "\n";
+}
+
+// Back to the state after the allocation, in the same memory: identity order, uniform costs, no lists
+template<class Layout>
+inline void reset_simulation(Simulation<Layout>& sim) {
+    for (int i = 0; i < sim.N; i++)
+        sim.id_of[i] = sim.slot_of[i] = i;
+    std::fill(sim.cost.begin(), sim.cost.end(), 1.0f);
+    std::fill(sim.busy_ns.begin(), sim.busy_ns.end(), 0);
+    sim.verlet.valid = false;
+}
+
+template<class Layout, class Exec>
+void run_point(Config cfg, const SweepConfig& sc, const SweepPoint& point, const std::string& layout,
+               uint64_t seed, std::ofstream& out) {
+    cfg.N = point.N;
+    cfg.threads = point.threads;
+    cfg.frames = sc.frames;
+
+    omp_set_num_threads(cfg.threads);
+    pin_threads(cfg.affinity); // before the allocation, the pages follow the threads
+
+    Simulation<Layout> sim = allocate_simulation<Layout, Exec>(cfg);
+    std::vector<double> ms_per_frame;
+
+    for (int r = 0; r < sc.repeats; r++) {
+        reset_simulation(sim);
+        init_boids<Layout, typename Exec::Parameters>(sim, seed + r);
+
+        int frame = 0;
+        for (int w = 0; w < sc.warmup; w++) {
+            step<Layout, Exec>(sim);
+            reorder_if_due(sim, ++frame);
+        }
+
+        PerfCounters counters;
+        if (cfg.counters)
+            open_perf_counters(counters, cfg.threads);
+
+        FrameStats stats = allocate_frame_stats(sc.frames);
+        for (int f = 0; f < sc.frames; f++) {
+            const auto start = std::chrono::steady_clock::now();
+
+            enable_perf_counters(counters);
+            step<Layout, Exec>(sim);
+            disable_perf_counters(counters);
+            reorder_if_due(sim, ++frame); // inside the measurement, like the executables
+
+            const auto end = std::chrono::steady_clock::now();
+            record_frame(stats, std::chrono::duration_cast<std::chrono::nanoseconds>(end - start).count());
+        }
+
+        const LatencySummary latency = summarize_frames(stats);
+        const CounterTotals counter_totals = close_perf_counters(counters);
+        ms_per_frame.push_back(latency.mean_ns / 1e6);
+
+        out << layout << "," << sim.kernel.name << "," << cfg.neighbours << "," << point.scaling << ","
+            << point.N << "," << point.threads << "," << r << "," << seed + r << "," << sc.frames << ","
+            << sc.warmup << "," << sc.weak << ","
+            << latency.total_ns / 1e6 << ","
+            << latency.mean_ns / 1e3 << ","
+            << latency.min_ns / 1e3 << ","
+            << latency.p50_ns / 1e3 << ","
+            << latency.p90_ns / 1e3 << ","
+            << latency.p99_ns / 1e3 << ","
+            << latency.max_ns / 1e3;
+        for (int k = 0; k < PERF_COUNTERS; k++) {
+            out << ",";
+            if (counter_totals.valid[k])
+                out << (long long)counter_totals.value[k];
+        }
+        out << std::endl; // flushed, the rows written so far survive an interrupted sweep
+    }
+
+    std::sort(ms_per_frame.begin(), ms_per_frame.end());
+    printf("%-18s %-9s %-6s %-6s N=%-7d threads=%-3d %.3f ms per frame (median of %d, min %.3f, max %.3f)\n",
+           layout.c_str(), sim.kernel.name, cfg.neighbours.c_str(), point.scaling, point.N, point.threads,
+           ms_per_frame[ms_per_frame.size() / 2], sc.repeats, ms_per_frame.front(), ms_per_frame.back());
+    fflush(stdout);
+
+    free_simulation(sim);
+}
+
+// Every point of a layout, with the compiled parameters when the values are the ones of Params
+template<class Layout, class Exec>
+void run_layout(const Config& cfg, const SweepConfig& sc, const std::string& layout, uint64_t seed, std::ofstream& out) {
+    if constexpr (std::is_same_v<typename Exec::Parameters, Params>) {
+        if (!params_are_compiled()) {
+            run_layout<Layout, WithParams<Exec, RuntimeParams>>(cfg, sc, layout, seed, out);
+            return;
+        }
+    }
+
+    for (const SweepPoint& point : sweep_points(sc))
+        run_point<Layout, Exec>(cfg, sc, point, layout, seed, out);
+}
+
+int main(int argc, char* argv[]) {
+
+    SweepConfig sc;
+    sc.parse(argc, argv);
+
+    // The options of the executables, with their parser
+    std::vector<char*> engine_argv = {argv[0]};
+    for (std::string& arg : sc.engine_args)
+        engine_argv.push_back(arg.data());
+    Config base;
+    base.parse((int)engine_argv.size(), engine_argv.data());
+
+    // Everything checked before the first point, a sweep can take hours
+    if (sc.repeats < 1 || sc.frames < 1 || sc.warmup < 0 || sc.N.empty() || sc.threads.empty()) {
+        std::cerr << "A sweep needs at least one N, one thread count, one repeat and one frame" << std::endl;
+        return EXIT_FAILURE;
+    }
+    for (const std::string& layout : sc.layouts) {
+        if (layout != "AOS" && layout != "AOS_parallel_SIMD" && layout != "SOA" && layout != "SOA_parallel_SIMD") {
+            std::cerr << "Unknown layout: " << layout << " (AOS, AOS_parallel_SIMD, SOA, SOA_parallel_SIMD)" << std::endl;
+            return EXIT_FAILURE;
+        }
+    }
+    if (!sc.neighbours.empty() && sc.neighbours != "all" && sc.neighbours != "grid" && sc.neighbours != "verlet") {
+        std::cerr << "Unknown neighbours search: " << sc.neighbours << std::endl;
+        return EXIT_FAILURE;
+    }
+    parse_schedule(base.schedule);
+    if ((base.symmetric || base.block != 0) && base.schedule != "static")
+        std::cerr << "Warning: --schedule " << base.schedule << " doesn't apply with --symmetric or --block, static used" << std::endl;
+    if (base.kernel != "auto")
+        select_kernel(base.kernel); // exits if the CPU doesn't support it
+    if (!base.snapshot.empty() || !base.restore.empty() || !base.trajectory.empty() || base.storage != "fp32"
+        || base.drift || base.pipeline || base.ensemble > 0)
+        std::cerr << "Warning: snapshots, trajectories, --storage, --drift, --pipeline and --ensemble don't apply to a sweep, ignored" << std::endl;
+
+    load_flock_params(base.params, base.param);
+    print_params();
+
+    const uint64_t seed = run_seed(base);
+    const std::vector<SweepPoint> points = sweep_points(sc);
+    std::cout << "Sweep: " << sc.layouts.size() << " layouts x " << points.size() << " points x " << sc.repeats
+              << " repeats, " << sc.warmup << " + " << sc.frames << " frames each, seed " << seed << " (repeat r: seed + r)\n";
+
+    std::ofstream out(sc.csv, std::ios::trunc);
+    if (!out) {
+        std::cerr << "Cannot write " << sc.csv << std::endl;
+        return EXIT_FAILURE;
+    }
+    write_sweep_header(out);
+
+    for (const std::string& layout : sc.layouts) {
+        Config cfg = base;
+        cfg.neighbours = sc.neighbours.empty() ? default_neighbours(layout) : sc.neighbours;
+
+        // The policies of the executables
+        if (layout == "AOS")
+            run_layout<AosLayout, OpenMP>(cfg, sc, layout, seed, out);
+        else if (layout == "AOS_parallel_SIMD")
+            run_layout<AlignedAosLayout, OpenMPSimd>(cfg, sc, layout, seed, out);
+        else if (layout == "SOA")
+            run_layout<SoaLayout, OpenMP>(cfg, sc, layout, seed, out);
+        else
+            run_layout<AlignedSoaLayout, OpenMPSimd>(cfg, sc, layout, seed, out);
+    }
+
+    std::cout << "Results in " << sc.csv << "\n";
+    return 0;
+}
@@ -0,0 +1,174 @@
+//
+// Created by giacomo on 07/02/26.
+//
+
+#include "headers/Boids_engine.h"
+#include "headers/AOS_helper.h"
+#include "headers/AOS_helper_SIMD.h"
+#include "headers/SOA_helper.h"
+#include "headers/SOA_helper_SIMD.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <fstream>
+#include <iostream>
+#include <random>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <omp.h>
+
+/**
+ * Microbenchmark of the neighbour kernel alone (accumulate_neighbours of Boids_engine.h), without
+ * SFML, frame loop or process startup in the numbers.
+ * For every layout (and, for the SOA ones, every SIMD kernel supported by the CPU) it runs a grid of
+ * N, threads and neighbour densities and reports the nanoseconds per pair interaction (N*N pairs per
+ * pass, all-pairs comparison). The density is the expected number of boids in the visual range of
+ * a boid: the boids are placed uniformly in a square whose side is chosen to give that density.
+ **/
+
+struct BenchConfig {
+
+    std::vector<int> N = {1000, 4000, 16000};
+    std::vector<int> threads = {1, 2, 4, 8};
+    std::vector<float> density = {1, 10, 100};
+    int warmup = 1;
+    int reps = 5;
+    std::string csv = "kernel_benchmark.csv";
+
+    //Parsing params passed via command line, lists are comma separated
+    void parse(int argc, char* argv[]) {
+        for (int i = 1; i < argc; ++i) {
+            std::string arg = argv[i];
+            if (arg == "--N" && i + 1 < argc) {
+                N = parse_list<int>(argv[++i]);
+            } else if (arg == "--threads" && i + 1 < argc) {
+                threads = parse_list<int>(argv[++i]);
+            } else if (arg == "--density" && i + 1 < argc) {
+                density = parse_list<float>(argv[++i]);
+            } else if (arg == "--warmup" && i + 1 < argc) {
+                warmup = std::stoi(argv[++i]);
+            } else if (arg == "--reps" && i + 1 < argc) {
+                reps = std::stoi(argv[++i]);
+            } else if (arg == "--csv" && i + 1 < argc) {
+                csv = argv[++i];
+            }
+            else {
+                std::cerr << "Unknown argument: " << arg << std::endl;
+            }
+        }
+    }
+
+    template<class T>
+    static std::vector<T> parse_list(const std::string& list) {
+        std::vector<T> values;
+        std::stringstream ss(list);
+        std::string item;
+        while (std::getline(ss, item, ','))
+            values.push_back((T)std::stod(item));
+        return values;
+    }
+};
+
+// Boids uniformly placed in a square giving on average `density` boids in the visual range
+template<class Layout>
+void fill_boids(typename Layout::Storage& boids, int N, float density) {
+    const float side = std::sqrt(N * (float)M_PI * Params::SQ_VISUAL_RANGE / density);
+    std::mt19937 gen(12345);
+    std::uniform_real_distribution<float> pos(0.0f, side);
+    std::uniform_real_distribution<float> vel(-Params::MAX_SPEED, Params::MAX_SPEED);
+
+    for (int i = 0; i < N; i++) {
+        const float x = pos(gen);
+        const float y = pos(gen);
+        const float vx = vel(gen);
+        const float vy = vel(gen);
+        Layout::store(boids, i, x, y, vx, vy);
+    }
+}
+
+// One pass of the kernel: every boid against every boid. Returns the neighbours found, so the
+// work can't be optimized away and the real density can be printed.
+template<class Layout, class Exec>
+double interaction_pass(const typename Layout::Storage& boids, int N, NeighbourKernel kernel) {
+    double found = 0.0;
+
+#pragma omp parallel for schedule(static) reduction(+:found) if(Exec::PARALLEL)
+    for (int i = 0; i < N; i++) {
+        Neighbourhood acc;
+        accumulate_neighbours<Layout, Exec>(boids, 0, N, Layout::x(boids, i), Layout::y(boids, i), 0.0f, acc, kernel);
+        found += acc.n_neighbours;
+    }
+
+    return found;
+}
+
+template<class Layout, class Exec>
+void bench_layout(const BenchConfig& bc, KernelInfo kernel, std::ofstream& out) {
+    for (int N : bc.N) {
+        typename Layout::Storage boids = Layout::allocate(N);
+
+        for (float density : bc.density) {
+            fill_boids<Layout>(boids, N, density);
+
+            for (int threads : bc.threads) {
+                omp_set_num_threads(threads);
+
+                double found = 0.0;
+                for (int w = 0; w < bc.warmup; w++)
+                    found = interaction_pass<Layout, Exec>(boids, N, kernel.fn);
+
+                std::vector<double> ns_per_pair;
+                for (int r = 0; r < bc.reps; r++) {
+                    const auto start = std::chrono::steady_clock::now();
+                    found = interaction_pass<Layout, Exec>(boids, N, kernel.fn);
+                    const auto end = std::chrono::steady_clock::now();
+
+                    const double ns = std::chrono::duration<double, std::nano>(end - start).count();
+                    ns_per_pair.push_back(ns / ((double)N * N));
+                }
+
+                std::sort(ns_per_pair.begin(), ns_per_pair.end());
+                const double min = ns_per_pair.front();
+                const double median = ns_per_pair[ns_per_pair.size() / 2];
+                const double neighbours = found / N;
+
+                printf("%-12s %-9s N=%-7d threads=%-3d density=%-6g neighbours=%-8.1f ns/pair min=%.4f median=%.4f\n",
+                       Layout::NAME, kernel.name, N, threads, density, neighbours, min, median);
+
+                out << Layout::NAME << "," << kernel.name << "," << N << "," << threads << ","
+                    << density << "," << neighbours << "," << min << "," << median << "\n";
+            }
+        }
+
+        Layout::release(boids);
+    }
+}
+
+int main(int argc, char* argv[]) {
+
+    BenchConfig bc;
+    bc.parse(argc, argv);
+
+    if (bc.reps < 1) {
+        std::cerr << "At least one repetition is needed" << std::endl;
+        return EXIT_FAILURE;
+    }
+
+    std::ofstream out(bc.csv);
+    out << "layout,kernel,N,threads,density,neighbours,ns_per_pair_min,ns_per_pair_median\n";
+
+    // The same pairs as the executables: branchy loop for the plain layouts, SIMD for the aligned ones
+    bench_layout<AosLayout, OpenMP>(bc, {"scalar", nullptr}, out);
+    bench_layout<SoaLayout, OpenMP>(bc, {"scalar", nullptr}, out);
+    bench_layout<AlignedAosLayout, OpenMPSimd>(bc, {"omp_simd", nullptr}, out);
+
+    for (const char* name : {"omp_simd", "sse42", "avx2", "avx512"}) {
+        if (!kernel_supported(name))
+            continue;
+        bench_layout<AlignedSoaLayout, OpenMPSimd>(bc, select_kernel(name), out);
+    }
+
+    return 0;
+}
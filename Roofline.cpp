@@ -0,0 +1,228 @@
+//
+// Created by giacomo on 27/02/26.
+//
+
+#include "headers/Boids_engine.h"
+#include "headers/Roofline.h"
+#include "headers/AOS_helper.h"
+#include "headers/AOS_helper_SIMD.h"
+#include "headers/SOA_helper.h"
+#include "headers/SOA_helper_SIMD.h"
+
+#include <algorithm>
+#include <chrono>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <omp.h>
+#include <unistd.h>
+
+/**
+ * Roofline harness: is a version compute-bound or bandwidth-bound at a given N?
+ * It first measures the limits of the machine with the threads of the run (see Roofline.h): the peak
+ * FMA throughput and the triad bandwidth from DRAM. Then, for every layout with the execution policy
+ * of its executable (and every SIMD kernel of the aligned SOA), it times the real frame (step() of
+ * Boids_engine.h, flock initialized in the window like the executables) with the all-pairs and the
+ * grid search, and counts flops and bytes analytically:
+ *  - flops: FLOPS_PER_PAIR for every pair tested, the branchless body (2 sub, squared distance 3,
+ *    alignment mask 1, close 4, the four averages 8, the count 1). The branchy loops skip part of it
+ *    for the far boids, but they are charged the same, so the GFLOP/s of two layouts compare the pairs
+ *    per second;
+ *  - bytes: BYTES_PER_PAIR (x, y, vx, vy of the other boid) for every pair, plus the per-boid traffic
+ *    of the frame (store of the new state and, with the grid, the counting sort).
+ * The pairs of the grid come from the occupancy of its cells, frame by frame.
+ * The bandwidth roof of a row is the triad measured on the working set of that frame, so it is the
+ * roof of the cache level the kernel streams from: at small N L1/L2, at large N (all-pairs) the LLC
+ * or DRAM. The row reports the achieved fraction of both roofs, the attainable performance
+ * min(peak, intensity * bandwidth) and which one binds.
+ **/
+
+constexpr double FLOPS_PER_PAIR = 19.0;
+constexpr double BYTES_PER_PAIR = 16.0;
+constexpr double BYTES_PER_BOID = 16.0;      // store of the new state
+constexpr double GRID_BYTES_PER_BOID = 44.0; // counting sort: read the boid and write cell_of, read cell_of, write binned and order
+
+struct RooflineConfig {
+
+    std::vector<int> N = {1000, 4000, 16000, 64000};
+    std::vector<std::string> search = {"all", "grid"};
+    int threads = 8;
+    int warmup = 2;
+    int reps = 5;
+    int stream_mb = 0; // total size of the DRAM triad, 0 = 4 times the last level cache
+    std::string csv = "roofline.csv";
+
+    //Parsing params passed via command line, lists are comma separated
+    void parse(int argc, char* argv[]) {
+        for (int i = 1; i < argc; ++i) {
+            std::string arg = argv[i];
+            if (arg == "--N" && i + 1 < argc) {
+                N.clear();
+                for (const std::string& v : split(argv[++i]))
+                    N.push_back(std::stoi(v));
+            } else if (arg == "--search" && i + 1 < argc) {
+                search = split(argv[++i]);
+            } else if (arg == "--threads" && i + 1 < argc) {
+                threads = std::stoi(argv[++i]);
+            } else if (arg == "--warmup" && i + 1 < argc) {
+                warmup = std::stoi(argv[++i]);
+            } else if (arg == "--reps" && i + 1 < argc) {
+                reps = std::stoi(argv[++i]);
+            } else if (arg == "--stream-mb" && i + 1 < argc) {
+                stream_mb = std::stoi(argv[++i]);
+            } else if (arg == "--csv" && i + 1 < argc) {
+                csv = argv[++i];
+            }
+            else {
+                std::cerr << "Unknown argument: " << arg << std::endl;
+            }
+        }
+    }
+
+    static std::vector<std::string> split(const std::string& list) {
+        std::vector<std::string> values;
+        std::stringstream ss(list);
+        std::string item;
+        while (std::getline(ss, item, ','))
+            values.push_back(item);
+        return values;
+    }
+};
+
+struct MachineRoofs {
+    FlopsRoof flops;
+    double dram_gbs;
+};
+
+// Pairs tested by the grid frame: every boid scans the 3 row ranges of the 3x3 cells around its own
+template<class Layout>
+double grid_pairs(const Grid<Layout>& grid) {
+    double pairs = 0.0;
+    for (int cy = 0; cy < grid.rows; cy++) {
+        for (int cx = 0; cx < grid.cols; cx++) {
+            const int cell = cy * grid.cols + cx;
+            const int boids = grid.cell_start[cell + 1] - grid.cell_start[cell];
+            if (boids == 0)
+                continue;
+
+            const int col_first = std::max(cx - 1, 0);
+            const int col_last = std::min(cx + 1, grid.cols - 1);
+            int scanned = 0;
+            for (int row = std::max(cy - 1, 0); row <= std::min(cy + 1, grid.rows - 1); row++)
+                scanned += grid.cell_start[row * grid.cols + col_last + 1] - grid.cell_start[row * grid.cols + col_first];
+            pairs += (double)boids * scanned;
+        }
+    }
+    return pairs;
+}
+
+template<class Layout, class Exec>
+void roofline_layout(const RooflineConfig& rc, const MachineRoofs& roofs, const std::string& kernel, std::ofstream& out) {
+    for (const std::string& search : rc.search) {
+        for (int N : rc.N) {
+            Config cfg;
+            cfg.N = N;
+            cfg.threads = rc.threads;
+            cfg.neighbours = search;
+            cfg.kernel = kernel;
+
+            Simulation<Layout> sim = allocate_simulation<Layout, Exec>(cfg);
+            init_boids<Layout>(sim, 12345);
+
+            for (int w = 0; w < rc.warmup; w++)
+                step<Layout, Exec>(sim);
+
+            // Fastest frame, with its own pairs (the grid ones change with the flock)
+            double best_s = 0.0, best_pairs = 0.0;
+            for (int r = 0; r < rc.reps; r++) {
+                const auto start = std::chrono::steady_clock::now();
+                step<Layout, Exec>(sim);
+                const double s = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+                const double pairs = sim.use_grid ? grid_pairs(sim.grid) : (double)N * N;
+                if (r == 0 || s / pairs < best_s / best_pairs) {
+                    best_s = s;
+                    best_pairs = pairs;
+                }
+            }
+
+            const double flops = FLOPS_PER_PAIR * best_pairs;
+            const double bytes = BYTES_PER_PAIR * best_pairs + (BYTES_PER_BOID + (sim.use_grid ? GRID_BYTES_PER_BOID : 0.0)) * N;
+            const double intensity = flops / bytes;
+            const double gflops = flops / best_s / 1e9;
+            const double gbs = bytes / best_s / 1e9;
+
+            // Boids and next state, plus the binned copy and the two index arrays of the grid
+            const size_t working_set = (size_t)N * (2 * 16 + (sim.use_grid ? 16 + 8 : 0));
+            const double cache_gbs = stream_triad(working_set, rc.threads, 3);
+            const double attainable = std::min(roofs.flops.gflops, intensity * cache_gbs);
+            const char* bound = intensity * cache_gbs < roofs.flops.gflops ? "memory" : "compute";
+
+            printf("%-12s %-9s %-5s N=%-7d %8.3f ms  %7.1f GFLOP/s (%5.1f%% of peak)  %7.1f GB/s (%5.1f%% of %.0f GB/s at %zu KiB, %5.1f%% of DRAM)  "
+                   "AI %.2f  %s-bound, %.1f%% of attainable\n",
+                   Layout::NAME, sim.kernel.name, search.c_str(), N, best_s * 1e3,
+                   gflops, 100.0 * gflops / roofs.flops.gflops,
+                   gbs, 100.0 * gbs / cache_gbs, cache_gbs, working_set / 1024, 100.0 * gbs / roofs.dram_gbs,
+                   intensity, bound, 100.0 * gflops / attainable);
+
+            out << Layout::NAME << "," << sim.kernel.name << "," << search << "," << N << "," << rc.threads << ","
+                << best_pairs << "," << best_s * 1e3 << "," << gflops << "," << roofs.flops.gflops << ","
+                << gbs << "," << cache_gbs << "," << roofs.dram_gbs << "," << intensity << ","
+                << gflops / roofs.flops.gflops << "," << gbs / cache_gbs << "," << bound << "\n";
+
+            free_simulation(sim);
+        }
+    }
+}
+
+int main(int argc, char* argv[]) {
+
+    RooflineConfig rc;
+    rc.parse(argc, argv);
+
+    if (rc.reps < 1 || rc.threads < 1) {
+        std::cerr << "At least one repetition and one thread are needed" << std::endl;
+        return EXIT_FAILURE;
+    }
+    for (const std::string& search : rc.search) {
+        if (search != "all" && search != "grid") {
+            std::cerr << "Unknown neighbours search: " << search << std::endl;
+            return EXIT_FAILURE;
+        }
+    }
+
+    omp_set_num_threads(rc.threads);
+
+    long llc = sysconf(_SC_LEVEL3_CACHE_SIZE);
+    if (llc <= 0)
+        llc = 32L * 1024 * 1024; // not reported by the system
+    const size_t stream_bytes = rc.stream_mb > 0 ? (size_t)rc.stream_mb * 1024 * 1024 : 4 * (size_t)llc;
+
+    MachineRoofs roofs;
+    roofs.flops = peak_flops(rc.threads, 5);
+    roofs.dram_gbs = stream_triad(stream_bytes, rc.threads, 5);
+
+    printf("Threads: %d\n", rc.threads);
+    printf("Peak FMA throughput (%s): %.1f GFLOP/s\n", roofs.flops.isa, roofs.flops.gflops);
+    printf("Triad bandwidth (%zu MiB, DRAM): %.1f GB/s\n", stream_bytes / (1024 * 1024), roofs.dram_gbs);
+    printf("Ridge point: %.2f flop/byte, a neighbour loop does %.2f (%.0f flops per %.0f bytes)\n",
+           roofs.flops.gflops / roofs.dram_gbs, FLOPS_PER_PAIR / BYTES_PER_PAIR, FLOPS_PER_PAIR, BYTES_PER_PAIR);
+
+    std::ofstream out(rc.csv);
+    out << "layout,kernel,search,N,threads,pairs,time_ms,gflops,peak_gflops,gbs,bandwidth_roof_gbs,dram_gbs,"
+           "intensity,compute_fraction,bandwidth_fraction,bound\n";
+
+    // The policies of the executables: branchy loop for the plain layouts, SIMD for the aligned ones
+    roofline_layout<AosLayout, OpenMP>(rc, roofs, "scalar", out);
+    roofline_layout<SoaLayout, OpenMP>(rc, roofs, "scalar", out);
+    roofline_layout<AlignedAosLayout, OpenMPSimd>(rc, roofs, "omp_simd", out);
+
+    for (const char* name : {"omp_simd", "sse42", "avx2", "avx512"}) {
+        if (kernel_supported(name))
+            roofline_layout<AlignedSoaLayout, OpenMPSimd>(rc, roofs, name, out);
+    }
+
+    return 0;
+}
@@ -0,0 +1,29 @@
+//
+// Created by giacomo on 23/02/26.
+//
+#include "headers/Simulation_run.h"
+#include "headers/SOA_helper_SIMD.h"
+
+/**
+ * SOA + SIMD version in 3D (--dims 3, the default) or 2D (--dims 2): aligned arrays for every
+ * coordinate, uniform grid, OpenMP + SIMD neighbour kernels. It runs the same engine of the 2D
+ * versions (Boids_engine.h) with the 3D layout, the z terms are added at compile time, so every
+ * option of SOA_parallel_SIMD (kernels, search, schedules, reordering, parameters, window) applies, e.g.:
+ *   ./SOA_3D --N 20000 --frames 100 --threads 4 --seed 1 --headless
+ **/
+
+int main(int argc, char* argv[]) {
+
+    Config cfg;
+    cfg.N = 1500;
+    cfg.neighbours = "grid";
+    cfg.parse(argc, argv);
+
+    if (cfg.dims == 2)
+        return run_simulation<AlignedSoaLayout, OpenMPSimd>(cfg);
+    if (cfg.dims == 3)
+        return run_simulation<AlignedSoaLayout3D, OpenMPSimd>(cfg);
+
+    std::cerr << "Only 2 or 3 dimensions: " << cfg.dims << std::endl;
+    return EXIT_FAILURE;
+}
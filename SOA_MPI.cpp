@@ -0,0 +1,31 @@
+//
+// Created by giacomo on 20/02/26.
+//
+#include "headers/Mpi_domain.h"
+#include "headers/SOA_helper_SIMD.h"
+
+/**
+ * Distributed SOA + SIMD version: the window is split in slabs among the MPI ranks, with halo
+ * exchange and migration of the boids every frame (see Mpi_domain.h), and inside every rank the same
+ * OpenMP + SIMD kernels of SOA_parallel_SIMD. Always headless, e.g. 4 ranks of 2 threads on one box:
+ *   mpirun -n 4 ./SOA_MPI --threads 2 --N 20000 --frames 100 --seed 1
+ **/
+
+int main(int argc, char* argv[]) {
+
+    // Only the main thread of a rank calls MPI, outside the parallel regions
+    int provided;
+    MPI_Init_thread(&argc, &argv, MPI_THREAD_FUNNELED, &provided);
+
+    Config cfg;
+    cfg.N = 1500;
+    cfg.threads = 2;
+    cfg.neighbours = "grid";
+    cfg.headless = true;
+    cfg.parse(argc, argv);
+
+    const int result = run_distributed<AlignedSoaLayout, OpenMPSimd>(cfg);
+
+    MPI_Finalize();
+    return result;
+}
@@ -5,46 +5,13 @@
 #pragma once //to include the file only once
 
 
-#include <string>
-#include <iostream>
 #include <memory>
-#include <SFML/Graphics.hpp>
-#include <bits/stdc++.h>
-
-struct Config {
-
-    int N = 1000;
-    int frames = 300;
-    int threads = 8;
-    std::string csv;
-
-
-    //Parsing params passed via command line
-    void parse(int argc, char* argv[]) {
-        for (int i = 1; i < argc; ++i) { //i = 1 because for i=0 we always have the exe path
-            std::string arg = argv[i];
-            if (arg == "--N" && i + 1 < argc) {
-                N = std::stoi(argv[++i]);
-            } else if (arg == "--frames" && i + 1 < argc) {
-                frames = std::stoi(argv[++i]);
-            }else if (arg == "--threads" && i + 1 < argc) {
-                threads = std::stoi(argv[++i]);
-            }else if (arg == "--csv" && i + 1 < argc) {
-                csv = argv[++i];
-            }
-            else {
-                std::cerr << "Unknown argument: " << arg << std::endl;
-            }
-        }
-    }
+#include <utility>
+#include <vector>
 
-    void print() const {
-        std::cout << "Config: N=" << N
-                  << ", frames=" << frames
-                  << ", threads=" << threads
-                  << std::endl;
-    }
-};
+/**
+ * Array Of Structures layout: a std::vector of boids, used by the AOS version.
+ **/
 
 //Shape separated from Boid to better parallelize
 struct Boid {
@@ -52,9 +19,44 @@ struct Boid {
     float vx, vy;
 };
 
-float random_float(float min, float max);
-void print_boids(const std::vector<Boid>& boids, std::vector<std::unique_ptr<sf::CircleShape>>& shapes,
-                 sf::RenderWindow& window);
-void append_csv(const std::string& filename,
-                int N, int frames, int threads,
-                long long time_ms);
\ No newline at end of file
+// std::allocator that default-initializes: Storage(N) leaves the boids unwritten, so their pages are
+// placed by first_touch() (see Numa.h) and not zero-filled by the allocating thread
+template<class T>
+struct DefaultInitAllocator : std::allocator<T> {
+    template<class U>
+    struct rebind { using other = DefaultInitAllocator<U>; };
+
+    using std::allocator<T>::allocator;
+
+    template<class U>
+    void construct(U* p) { ::new ((void*)p) U; }
+
+    template<class U, class... Args>
+    void construct(U* p, Args&&... args) { ::new ((void*)p) U(std::forward<Args>(args)...); }
+};
+
+// Layout policy for the engine (see Boids_engine.h)
+struct AosLayout {
+    static constexpr const char* NAME = "AOS";
+    static constexpr int D = 2; // Boid/AlignedBoid are 2D
+    using Storage = std::vector<Boid, DefaultInitAllocator<Boid>>;
+    static constexpr bool CONTIGUOUS = false; // fields interleaved, only the compiler vectorized loop
+
+    static Storage allocate(int N) { return Storage(N); }
+    static void release(Storage&) {}
+
+    static float x(const Storage& b, int i)  { return b[i].x; }
+    static float y(const Storage& b, int i)  { return b[i].y; }
+    static float vx(const Storage& b, int i) { return b[i].vx; }
+    static float vy(const Storage& b, int i) { return b[i].vy; }
+    static const void* address(const Storage& b, int i) { return &b[i]; } // for the NUMA placement report
+
+    static void store(Storage& b, int i, float x, float y, float vx, float vy) {
+        b[i] = {x, y, vx, vy};
+    }
+
+    // Boid s of src into slot d of dst (grid binning and reordering)
+    static void copy(Storage& dst, int d, const Storage& src, int s) {
+        dst[d] = src[s];
+    }
+};
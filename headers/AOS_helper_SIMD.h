@@ -5,57 +5,18 @@
 #pragma once //to include the file only once
 
 /**
- * This helper is very similar to the AOS one, but uses padding and SIMD instructions.
+ * This helper is very similar to the AOS one, but uses padding and memory alignment for SIMD instructions.
  **/
 
 
-#include <string>
+#include <cstdlib>
 #include <iostream>
-#include <memory>
-#include <SFML/Graphics.hpp>
-#include <bits/stdc++.h>
-
-
-
-struct Config {
-
-    int N = 1500;
-    int frames = 300;
-    int threads = 8;
-    std::string csv;
-
-
-    //Parsing params passed via command line
-    void parse(int argc, char* argv[]) {
-        for (int i = 1; i < argc; ++i) { //i = 1 because for i=0 we always have the exe path
-            std::string arg = argv[i];
-            if (arg == "--N" && i + 1 < argc) {
-                N = std::stoi(argv[++i]);
-            } else if (arg == "--frames" && i + 1 < argc) {
-                frames = std::stoi(argv[++i]);
-            }else if (arg == "--threads" && i + 1 < argc) {
-                threads = std::stoi(argv[++i]);
-            }else if (arg == "--csv" && i + 1 < argc) {
-                csv = argv[++i];
-            }
-            else {
-                std::cerr << "Unknown argument: " << arg << std::endl;
-            }
-        }
-    }
 
-    void print() const {
-        std::cout << "Config: N=" << N
-                  << ", frames=" << frames
-                  << ", threads=" << threads
-                  << std::endl;
-    }
-};
 #define CACHE_SIZE  32
 
 //Shape separated from Boid to better parallelize
 // comment alignas(CACHE_SIZE) to test without padding
-struct /*alignas(CACHE_SIZE)*/ Boid { // CACHE_SIZE = 32 for my CPU.
+struct /*alignas(CACHE_SIZE)*/ AlignedBoid { // CACHE_SIZE = 32 for my CPU.
     float x, y;
     float vx, vy;
 
@@ -63,12 +24,53 @@ struct /*alignas(CACHE_SIZE)*/ Boid { // CACHE_SIZE = 32 for my CPU.
    // char padding = (CACHE_SIZE - sizeof(float)*4); //to do a more "internal" padding and not only alignment
 };
 
+// Aligned allocation ensures the starting address of each array is a multiple of 32 bytes.
+inline AlignedBoid* allocate_aligned_boids_aos(int N) {
+
+    const size_t ALIGNMENT = 32;
+
+    size_t total_size = N * sizeof(AlignedBoid);
+
+    // Padding: size passed to aligned_alloc must be a multiple of alignment
+    if (total_size % ALIGNMENT != 0) {
+        total_size += ALIGNMENT - (total_size % ALIGNMENT);
+    }
 
-Boid* allocate_aligned_boids(int N);
+    void* ptr = std::aligned_alloc(ALIGNMENT, total_size);
 
-float random_float(float min, float max);
-void print_boids(const Boid* boids, int N, std::vector<std::unique_ptr<sf::CircleShape>>& shapes,
-                 sf::RenderWindow& window);
-void append_csv(const std::string& filename,
-                int N, int frames, int threads,
-                long long time_ms);
+    if (!ptr) {
+        std::cerr << "Aligned allocation failed!" << std::endl;
+        exit(EXIT_FAILURE);
+    }
+
+    return static_cast<AlignedBoid*>(ptr);
+}
+
+// Layout policy for the engine (see Boids_engine.h)
+struct AlignedAosLayout {
+    static constexpr const char* NAME = "AOS_aligned";
+    static constexpr int D = 2; // Boid/AlignedBoid are 2D
+    using Storage = AlignedBoid*;
+    static constexpr bool CONTIGUOUS = false; // fields interleaved, only the compiler vectorized loop
+
+    static Storage allocate(int N) { return allocate_aligned_boids_aos(N); }
+    static void release(Storage& b) { std::free(b); }
+
+    static float x(const Storage& b, int i)  { return b[i].x; }
+    static float y(const Storage& b, int i)  { return b[i].y; }
+    static float vx(const Storage& b, int i) { return b[i].vx; }
+    static float vy(const Storage& b, int i) { return b[i].vy; }
+    static const void* address(const Storage& b, int i) { return &b[i]; } // for the NUMA placement report
+
+    static void store(Storage& b, int i, float x, float y, float vx, float vy) {
+        b[i].x = x;
+        b[i].y = y;
+        b[i].vx = vx;
+        b[i].vy = vy;
+    }
+
+    // Boid s of src into slot d of dst (grid binning and reordering)
+    static void copy(Storage& dst, int d, const Storage& src, int s) {
+        dst[d] = src[s];
+    }
+};
@@ -0,0 +1,1009 @@
+//
+// Created by giacomo on 03/02/26.
+//
+
+#pragma once //to include the file only once
+
+#include "Config.h"
+#include "Counter_rng.h"
+#include "Flock_params.h"
+#include "Grid.h"
+#include "Kernels_SIMD.h"
+#include "Numa.h"
+#include "Pair_buffers.h"
+#include "Reorder.h"
+#include "Verlet.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdlib>
+#include <iostream>
+#include <random>
+#include <string>
+#include <type_traits>
+#include <utility>
+#include <vector>
+#include <omp.h>
+#include <unistd.h>
+
+/**
+ * Boids simulation core shared by every version. It is header-only and templated on:
+ *  - a layout policy, which says how the boids are stored (AosLayout, AlignedAosLayout, SoaLayout,
+ *    AlignedSoaLayout, AlignedSoaLayout3D, see the helpers). It exposes the dimensions D (2 or 3),
+ *    Storage, allocate/release, the x/y/vx/vy getters (z/vz in 3D), store(), copy() and address()
+ *    (for the NUMA report). The 3D flock runs through the same functions, the z terms are added
+ *    with if constexpr on Layout::D, so the 2D instantiations are the same code as before;
+ *  - an execution policy, which says how the frame is computed (Sequential, OpenMP, OpenMPSimd).
+ *    With OpenMPSimd the layouts with contiguous arrays (CONTIGUOUS) use the hand-written kernel
+ *    chosen at startup (see Kernels_SIMD.h).
+ * The executables are thin front-ends choosing the two policies, so an optimization written here
+ * is automatically in every layout comparison. This file has no graphics (the frame loop with SFML
+ * is in Simulation_run.h), so the benchmarks can use it alone.
+ **/
+
+// Execution policies. Without PARALLEL the parallel region runs with a team of one thread,
+// with SIMD the neighbour loop is the branchless one under #pragma omp simd.
+// Parameters is the set of model parameters the kernels are compiled with (see Flock_params.h).
+struct Sequential {
+    static constexpr const char* NAME = "sequential";
+    static constexpr bool PARALLEL = false;
+    static constexpr bool SIMD = false;
+    using Parameters = Params;
+};
+
+struct OpenMP {
+    static constexpr const char* NAME = "openmp";
+    static constexpr bool PARALLEL = true;
+    static constexpr bool SIMD = false;
+    using Parameters = Params;
+};
+
+struct OpenMPSimd {
+    static constexpr const char* NAME = "openmp_simd";
+    static constexpr bool PARALLEL = true;
+    static constexpr bool SIMD = true;
+    using Parameters = Params;
+};
+
+// The same policy with another parameter set, e.g. WithParams<OpenMPSimd, RuntimeParams>
+template<class Exec, class P>
+struct WithParams : Exec {
+    using Parameters = P;
+};
+
+// How the boids of the frame loop are split among the threads (--schedule)
+enum class Schedule { STATIC, BALANCED, DYNAMIC };
+constexpr int DYNAMIC_CHUNK = 64;
+
+inline Schedule parse_schedule(const std::string& name) {
+    if (name == "static")
+        return Schedule::STATIC;
+    if (name == "balanced")
+        return Schedule::BALANCED;
+    if (name == "dynamic")
+        return Schedule::DYNAMIC;
+
+    std::cerr << "Unknown schedule: " << name << std::endl;
+    exit(EXIT_FAILURE);
+}
+
+template<class Layout>
+struct Simulation {
+    int N;
+    bool use_grid;
+    bool use_verlet;    // candidates from the Verlet lists (see Verlet.h)
+    bool symmetric;
+    int block;          // boids per tile of the all-pairs traversal, 0 = not tiled
+    std::vector<Neighbourhood> tile_acc; // sums of the block of every thread, n_threads * block
+    KernelInfo kernel;
+    typename Layout::Storage boids;
+    typename Layout::Storage boids_next;
+    Grid<Layout> grid;
+    PairBuffers pairs;
+    VerletLists<Layout> verlet;
+
+    std::vector<int> id_of;   // storage index -> boid, changed only by the reordering
+    std::vector<int> slot_of; // boid -> storage index
+    Reordering reordering;
+
+    Schedule schedule;
+    std::vector<float> cost;        // estimated cost of every boid (original index) in the last frame
+    std::vector<int> bounds;        // n_threads + 1 limits of the balanced ranges
+    std::vector<long long> busy_ns; // time spent by every thread in the frame loop
+};
+
+/**
+ * Block size of the tiled traversal for --block auto: a tile of j boids (x, y, vx, vy, and z, vz in 3D)
+ * takes half of the L2 cache, the other half is left to the i boids and their accumulators. The blocks
+ * are also small enough to give at least one to every thread.
+ **/
+inline int auto_block_size(int N, int n_threads, int dims = 2) {
+    long l2 = sysconf(_SC_LEVEL2_CACHE_SIZE);
+    if (l2 <= 0)
+        l2 = 256 * 1024; // not reported by the system
+    const int block = std::min((int)(l2 / 2 / (2 * dims * sizeof(float))), (N + n_threads - 1) / n_threads);
+    return std::max(64, block / 64 * 64);
+}
+
+template<class Layout, class Exec>
+inline Simulation<Layout> allocate_simulation(const Config& cfg) {
+    using P = typename Exec::Parameters;
+    Simulation<Layout> sim{};
+    sim.N = cfg.N;
+    sim.use_grid = cfg.neighbours == "grid";
+    sim.use_verlet = cfg.neighbours == "verlet";
+    sim.symmetric = cfg.symmetric && !sim.use_verlet;
+    sim.schedule = parse_schedule(cfg.schedule);
+    sim.cost.assign(cfg.N, 1.0f); // uniform before the first frame
+    sim.bounds.assign(omp_get_max_threads() + 1, 0);
+    sim.busy_ns.assign(omp_get_max_threads(), 0);
+    sim.id_of.resize(cfg.N);
+    sim.slot_of.resize(cfg.N);
+    for (int i = 0; i < cfg.N; i++)
+        sim.id_of[i] = sim.slot_of[i] = i;
+    sim.reordering = allocate_reordering(cfg.N, cfg.reorder_every, cfg.curve, P::X_SIZE, P::Y_SIZE, cfg.threads);
+    // Tiling only for the full all-pairs traversal, the grid ranges are already local
+    sim.block = sim.use_grid || sim.use_verlet || sim.symmetric ? 0 : cfg.block < 0 ? auto_block_size(cfg.N, cfg.threads, Layout::D) : cfg.block;
+    // The symmetric and tiled frames split rows/blocks statically (see step_symmetric, step_tiled)
+    if (sim.symmetric || sim.block > 0)
+        sim.schedule = Schedule::STATIC;
+
+    // Intrinsics kernels only for the SIMD policy on contiguous arrays, the symmetric and the Verlet ones have their own loop
+    if (sim.symmetric)
+        sim.kernel = {Exec::SIMD ? "symmetric_simd" : "symmetric", nullptr};
+    else if (sim.use_verlet)
+        sim.kernel = {Exec::SIMD ? "verlet_simd" : "verlet", nullptr};
+    else if constexpr (Exec::SIMD && Layout::CONTIGUOUS)
+        sim.kernel = select_kernel<Layout::D>(cfg.kernel);
+    else
+        sim.kernel = {Exec::SIMD ? "omp_simd" : "scalar", nullptr};
+    sim.boids = Layout::allocate(cfg.N);
+    sim.boids_next = Layout::allocate(cfg.N);
+
+    // Cells as wide as the visual range, rebuilt at every frame
+    if (sim.use_grid)
+        sim.grid = allocate_grid<Layout>(cfg.N, P::X_SIZE, P::Y_SIZE, P::Z_SIZE, P::VISUAL_RANGE, cfg.threads);
+    if (sim.symmetric)
+        sim.pairs = allocate_pair_buffers(cfg.N, cfg.threads, Layout::D);
+    if (sim.block > 0)
+        sim.tile_acc.resize((size_t)cfg.threads * sim.block);
+    if (sim.use_verlet)
+        sim.verlet = allocate_verlet<Layout>(cfg.N, P::VISUAL_RANGE, cfg.skin, P::X_SIZE, P::Y_SIZE, P::Z_SIZE,
+                                               cfg.threads);
+
+    // Pages placed on the node of the thread that will use them (see Numa.h)
+    first_touch<Layout>(sim.boids, cfg.N);
+    first_touch<Layout>(sim.boids_next, cfg.N);
+    if (sim.use_grid) {
+        first_touch<Layout>(sim.grid.binned, cfg.N);
+        first_touch_array(sim.grid.order, cfg.N);
+        first_touch_array(sim.grid.cell_of, cfg.N);
+    }
+    if (sim.use_verlet) {
+        first_touch<Layout>(sim.verlet.grid.binned, cfg.N);
+        first_touch_array(sim.verlet.grid.order, cfg.N);
+        first_touch_array(sim.verlet.grid.cell_of, cfg.N);
+    }
+
+    return sim;
+}
+
+template<class Layout>
+inline void free_simulation(Simulation<Layout>& sim) {
+    Layout::release(sim.boids);
+    Layout::release(sim.boids_next);
+    if (sim.use_grid)
+        free_grid(sim.grid);
+    if (sim.symmetric)
+        free_pair_buffers(sim.pairs);
+    if (sim.use_verlet)
+        free_verlet(sim.verlet);
+}
+
+// Seed of the run: the one passed with --seed, otherwise a random one (printed, to repeat the run)
+inline uint64_t run_seed(const Config& cfg) {
+    return cfg.seed_set ? cfg.seed : ((uint64_t)std::random_device{}() << 32) | std::random_device{}();
+}
+
+/**
+ * Initial state of boid i: it uses the counters 2D*i..2D*i+2D-1 (see Counter_rng.h), positions first
+ * and then velocities, so any boid can be drawn alone. In 2D z = vz = 0 and the draws are x, y, vx, vy.
+ **/
+template<int D = 2, class P = Params>
+inline void initial_boid(uint64_t key, int i, float& x, float& y, float& z, float& vx, float& vy, float& vz,
+                         const P& p = P{}) {
+    const uint64_t counter = (uint64_t)i * 2 * D;
+    x = counter_uniform(key, counter, p.LEFT_MARGIN + p.MARGIN, p.RIGHT_MARGIN - p.MARGIN);
+    y = counter_uniform(key, counter + 1, p.BOT_MARGIN + p.MARGIN, p.TOP_MARGIN - p.MARGIN);
+    z = D == 3 ? counter_uniform(key, counter + 2, p.FRONT_MARGIN + p.MARGIN, p.BACK_MARGIN - p.MARGIN) : 0.0f;
+    vx = counter_uniform(key, counter + D, -p.MAX_SPEED, p.MAX_SPEED);
+    vy = counter_uniform(key, counter + D + 1, -p.MAX_SPEED, p.MAX_SPEED);
+    vz = D == 3 ? counter_uniform(key, counter + 5, -p.MAX_SPEED, p.MAX_SPEED) : 0.0f;
+}
+
+// Boids initialization, in parallel
+template<class Layout, class P = Params>
+inline void init_boids(Simulation<Layout>& sim, uint64_t seed) {
+    const uint64_t key = squares_key(seed);
+    const int N = sim.N;
+
+#pragma omp parallel for schedule(static) default(none) shared(sim, N, key)
+    for (int i = 0; i < N; i++) {
+        float x, y, z, vx, vy, vz;
+        initial_boid<Layout::D, P>(key, i, x, y, z, vx, vy, vz);
+        store_boid<Layout>(sim.boids, i, x, y, z, vx, vy, vz);
+    }
+}
+
+/**
+ * The branchless omp simd loops of the SIMD policy are the always_inline run() of the structs below:
+ * run_simd_loop() (see Kernels_SIMD.h) compiles each one for the baseline x86-64 and inside an AVX2+FMA
+ * and an AVX-512 wrapper, and calls the widest the CPU supports. Without a global -m flag they
+ * would otherwise be SSE2 only, also for the layouts that have no intrinsics kernel.
+ * The loops read the boids through a local copy of the storage (LoopStorage): through the reference
+ * GCC reloads the array pointers at every iteration, the loads become gathers and the loop is not
+ * vectorized at all. The handles of the SOA layouts and AlignedAosLayout are a few pointers, the
+ * std::vector of AosLayout is not copied.
+ **/
+template<class Storage>
+using LoopStorage = std::conditional_t<std::is_trivially_copyable_v<Storage>, const Storage, const Storage&>;
+
+// Branchless loop of accumulate_neighbours for the SIMD policy, see run_simd_loop()
+template<class Layout, class P>
+struct NeighboursLoop {
+    __attribute__((always_inline))
+    static inline void run(const typename Layout::Storage& boids, int first, int last, float xi, float yi, float zi,
+                           Neighbourhood& acc, const P& p) {
+        LoopStorage<typename Layout::Storage> b = boids;
+        float x_avg = 0.0f, y_avg = 0.0f, xv_avg = 0.0f, yv_avg = 0.0f;
+        float n_neighbours = 0.0f, close_dx = 0.0f, close_dy = 0.0f;
+        float z_avg = 0.0f, zv_avg = 0.0f, close_dz = 0.0f;
+
+#pragma omp simd reduction(+:close_dx, close_dy, close_dz, xv_avg, yv_avg, zv_avg, x_avg, y_avg, z_avg, n_neighbours)
+        for (int j = first; j < last; j++) {
+
+            float dx = xi - Layout::x(b, j);
+            float dy = yi - Layout::y(b, j);
+            float dist_sq = dx*dx + dy*dy;
+            float dz = 0.0f;
+            if constexpr (Layout::D == 3) {
+                dz = zi - Layout::z(b, j);
+                dist_sq += dz*dz;
+            }
+
+
+            float is_protected = (dist_sq < p.SQ_PROTECTED_RANGE) ? 1.0f : 0.0f;
+            float is_visible   = (dist_sq < p.SQ_VISUAL_RANGE) ? 1.0f : 0.0f;
+
+            // A boid aligns only if it's visible BUT NOT protected
+            float is_alignment = is_visible - is_protected;
+
+            // Branchless logic
+            close_dx += dx * is_protected;
+            close_dy += dy * is_protected;
+
+
+            xv_avg += Layout::vx(b, j) * is_alignment;
+            yv_avg += Layout::vy(b, j) * is_alignment;
+            x_avg  += Layout::x(b, j)  * is_alignment;
+            y_avg  += Layout::y(b, j)  * is_alignment;
+            if constexpr (Layout::D == 3) {
+                close_dz += dz * is_protected;
+                zv_avg += Layout::vz(b, j) * is_alignment;
+                z_avg  += Layout::z(b, j)  * is_alignment;
+            }
+            n_neighbours += is_alignment;
+        }
+
+        // --- End SIMD Loop ---
+
+        acc.x_avg += x_avg;
+        acc.y_avg += y_avg;
+        acc.xv_avg += xv_avg;
+        acc.yv_avg += yv_avg;
+        acc.n_neighbours += n_neighbours;
+        acc.close_dx += close_dx;
+        acc.close_dy += close_dy;
+        if constexpr (Layout::D == 3) {
+            acc.z_avg += z_avg;
+            acc.zv_avg += zv_avg;
+            acc.close_dz += close_dz;
+        }
+    }
+};
+
+/**
+ * Accumulates the contribution of the boids in [first, last) on the boid in (xi, yi, zi).
+ * The boid itself can be in the range: its distance is 0, so it only adds 0 to close_dx/dy.
+ * zi and the z terms are only used in 3D (Layout::D == 3), the 2D loops are unchanged.
+ * The parameters are read through p: with the static sets (Params, RuntimeParams) it is an empty
+ * object and they are the usual constants/variables, with MemberParams they are the ones of a member
+ * of an ensemble (see Ensemble.h). The same for steer() and initial_boid().
+ **/
+template<class Layout, class Exec>
+inline void accumulate_neighbours(const typename Layout::Storage& b, int first, int last,
+                                  float xi, float yi, float zi, Neighbourhood& acc, NeighbourKernel kernel,
+                                  const typename Exec::Parameters& p = {}) {
+
+    if constexpr (Exec::SIMD && Layout::CONTIGUOUS) {
+        if (kernel) {
+            kernel(b.x, b.y, b.z, b.vx, b.vy, b.vz, first, last, xi, yi, zi,
+                   p.SQ_PROTECTED_RANGE, p.SQ_VISUAL_RANGE, acc);
+            return;
+        }
+    }
+
+    if constexpr (Exec::SIMD) {
+        run_simd_loop<NeighboursLoop<Layout, typename Exec::Parameters>>(b, first, last, xi, yi, zi, acc, p);
+    } else {
+        for (int j = first; j < last; j++) {
+
+            float dx = xi - Layout::x(b, j);
+            float dy = yi - Layout::y(b, j);
+            float dz = Layout::D == 3 ? zi - layout_z<Layout>(b, j) : 0.0f;
+
+            if (std::fabs(dx) < p.VISUAL_RANGE && std::fabs(dy) < p.VISUAL_RANGE && std::fabs(dz) < p.VISUAL_RANGE) {
+
+                float sqd = dx*dx + dy*dy;
+                if constexpr (Layout::D == 3)
+                    sqd += dz*dz;
+
+                if (sqd < p.SQ_PROTECTED_RANGE) {
+                    //Distance from near boids
+                    acc.close_dx += dx;
+                    acc.close_dy += dy;
+                    if constexpr (Layout::D == 3)
+                        acc.close_dz += dz;
+
+                    //if not in protected range, check the visual one
+                } else if (sqd < p.SQ_VISUAL_RANGE) {
+                    acc.x_avg += Layout::x(b, j);
+                    acc.y_avg += Layout::y(b, j);
+                    acc.xv_avg += Layout::vx(b, j);
+                    acc.yv_avg += Layout::vy(b, j);
+                    if constexpr (Layout::D == 3) {
+                        acc.z_avg += Layout::z(b, j);
+                        acc.zv_avg += Layout::vz(b, j);
+                    }
+                    acc.n_neighbours++;
+                }
+            }
+        }
+    }
+}
+
+// Branchless loop of accumulate_candidates for the SIMD policy, see run_simd_loop()
+template<class Layout, class P>
+struct CandidatesLoop {
+    __attribute__((always_inline))
+    static inline void run(const typename Layout::Storage& boids, const int* candidates, int first, int last,
+                           float xi, float yi, float zi, Neighbourhood& acc) {
+        LoopStorage<typename Layout::Storage> b = boids;
+        float x_avg = 0.0f, y_avg = 0.0f, xv_avg = 0.0f, yv_avg = 0.0f;
+        float n_neighbours = 0.0f, close_dx = 0.0f, close_dy = 0.0f;
+        float z_avg = 0.0f, zv_avg = 0.0f, close_dz = 0.0f;
+
+#pragma omp simd reduction(+:close_dx, close_dy, close_dz, xv_avg, yv_avg, zv_avg, x_avg, y_avg, z_avg, n_neighbours)
+        for (int k = first; k < last; k++) {
+            const int j = candidates[k];
+            float xj = Layout::x(b, j);
+            float yj = Layout::y(b, j);
+            float dx = xi - xj;
+            float dy = yi - yj;
+            float dist_sq = dx*dx + dy*dy;
+            float zj = 0.0f, dz = 0.0f;
+            if constexpr (Layout::D == 3) {
+                zj = Layout::z(b, j);
+                dz = zi - zj;
+                dist_sq += dz*dz;
+            }
+
+            float is_protected = (dist_sq < P::SQ_PROTECTED_RANGE) ? 1.0f : 0.0f;
+            float is_alignment = ((dist_sq < P::SQ_VISUAL_RANGE) ? 1.0f : 0.0f) - is_protected;
+
+            close_dx += dx * is_protected;
+            close_dy += dy * is_protected;
+            xv_avg += Layout::vx(b, j) * is_alignment;
+            yv_avg += Layout::vy(b, j) * is_alignment;
+            x_avg  += xj * is_alignment;
+            y_avg  += yj * is_alignment;
+            if constexpr (Layout::D == 3) {
+                close_dz += dz * is_protected;
+                zv_avg += Layout::vz(b, j) * is_alignment;
+                z_avg  += zj * is_alignment;
+            }
+            n_neighbours += is_alignment;
+        }
+
+        acc.x_avg += x_avg;
+        acc.y_avg += y_avg;
+        acc.xv_avg += xv_avg;
+        acc.yv_avg += yv_avg;
+        acc.n_neighbours += n_neighbours;
+        acc.close_dx += close_dx;
+        acc.close_dy += close_dy;
+        if constexpr (Layout::D == 3) {
+            acc.z_avg += z_avg;
+            acc.zv_avg += zv_avg;
+            acc.close_dz += close_dz;
+        }
+    }
+};
+
+/**
+ * Same as accumulate_neighbours, over the candidates[first, last) of a Verlet list instead of a
+ * range: the loads are gathers, so there is no intrinsics kernel, the SIMD policy vectorizes the
+ * branchless loop with omp simd.
+ **/
+template<class Layout, class Exec>
+inline void accumulate_candidates(const typename Layout::Storage& b, const int* candidates, int first, int last,
+                                  float xi, float yi, float zi, Neighbourhood& acc) {
+    using P = typename Exec::Parameters;
+
+    if constexpr (Exec::SIMD) {
+        run_simd_loop<CandidatesLoop<Layout, P>>(b, candidates, first, last, xi, yi, zi, acc);
+    } else {
+        for (int k = first; k < last; k++) {
+            const int j = candidates[k];
+            float dx = xi - Layout::x(b, j);
+            float dy = yi - Layout::y(b, j);
+            float dz = Layout::D == 3 ? zi - layout_z<Layout>(b, j) : 0.0f;
+            float sqd = dx*dx + dy*dy;
+            if constexpr (Layout::D == 3)
+                sqd += dz*dz;
+
+            if (sqd < P::SQ_PROTECTED_RANGE) {
+                acc.close_dx += dx;
+                acc.close_dy += dy;
+                if constexpr (Layout::D == 3)
+                    acc.close_dz += dz;
+            } else if (sqd < P::SQ_VISUAL_RANGE) {
+                acc.x_avg += Layout::x(b, j);
+                acc.y_avg += Layout::y(b, j);
+                acc.xv_avg += Layout::vx(b, j);
+                acc.yv_avg += Layout::vy(b, j);
+                if constexpr (Layout::D == 3) {
+                    acc.z_avg += Layout::z(b, j);
+                    acc.zv_avg += Layout::vz(b, j);
+                }
+                acc.n_neighbours++;
+            }
+        }
+    }
+}
+
+/**
+ * New velocity of a boid from the sums over its neighbours, the edges and the speed limits.
+ * In 3D the same on z, with the edges at FRONT_MARGIN/BACK_MARGIN and the limits on the 3D speed;
+ * in 2D zi and vzi are not touched.
+ **/
+template<int D, class P>
+inline void steer(float xi, float yi, float zi, float& vxi, float& vyi, float& vzi, Neighbourhood acc, const P& p = P{}) {
+
+    //If there are boids in the visual range, make the boids go to their center
+    if (acc.n_neighbours > 0.0f) {
+        acc.x_avg /= acc.n_neighbours;
+        acc.y_avg /= acc.n_neighbours;
+        acc.xv_avg /= acc.n_neighbours;
+        acc.yv_avg /= acc.n_neighbours;
+
+        vxi += (acc.x_avg - xi) * p.CENTERING_FACTOR + (acc.xv_avg - vxi) * p.MATCHING_FACTOR;
+        vyi += (acc.y_avg - yi) * p.CENTERING_FACTOR + (acc.yv_avg - vyi) * p.MATCHING_FACTOR;
+        if constexpr (D == 3) {
+            acc.z_avg /= acc.n_neighbours;
+            acc.zv_avg /= acc.n_neighbours;
+            vzi += (acc.z_avg - zi) * p.CENTERING_FACTOR + (acc.zv_avg - vzi) * p.MATCHING_FACTOR;
+        }
+    }
+
+    vxi += acc.close_dx * p.AVOID_FACTOR;
+    vyi += acc.close_dy * p.AVOID_FACTOR;
+
+    //Verification of edges condition
+    if (yi > p.TOP_MARGIN - p.MARGIN)
+        vyi -= p.TURN_FACTOR;
+    if (yi < p.BOT_MARGIN + p.MARGIN)
+        vyi += p.TURN_FACTOR;
+    if (xi < p.LEFT_MARGIN + p.MARGIN)
+        vxi += p.TURN_FACTOR;
+    if (xi > p.RIGHT_MARGIN - p.MARGIN)
+        vxi -= p.TURN_FACTOR;
+
+    float speed_sq = vxi*vxi + vyi*vyi;
+
+    if constexpr (D == 3) {
+        vzi += acc.close_dz * p.AVOID_FACTOR;
+        if (zi > p.BACK_MARGIN - p.MARGIN)
+            vzi -= p.TURN_FACTOR;
+        if (zi < p.FRONT_MARGIN + p.MARGIN)
+            vzi += p.TURN_FACTOR;
+        speed_sq += vzi*vzi;
+    }
+
+    float speed = std::sqrt(speed_sq);
+
+    if (speed > 0 && speed < p.MIN_SPEED) {
+        float scale = p.MIN_SPEED / speed;
+        vxi *= scale;
+        vyi *= scale;
+        if constexpr (D == 3)
+            vzi *= scale;
+    } else if (speed > p.MAX_SPEED) {
+        float scale = p.MAX_SPEED / speed;
+        vxi *= scale;
+        vyi *= scale;
+        if constexpr (D == 3)
+            vzi *= scale;
+    }
+}
+
+// Branchless loop of accumulate_pairs for the SIMD policy, see run_simd_loop()
+template<class Layout, class P>
+struct PairsLoop {
+    __attribute__((always_inline))
+    static inline void run(const typename Layout::Storage& boids, int first, int last,
+                           float xi, float yi, float zi, float vxi, float vyi, float vzi,
+                           Neighbourhood& acc, PairBuffers& buffers, int tid) {
+        LoopStorage<typename Layout::Storage> b = boids;
+        float* __restrict out_x = pair_field(buffers, tid, PAIR_X_AVG);
+        float* __restrict out_y = pair_field(buffers, tid, PAIR_Y_AVG);
+        float* __restrict out_vx = pair_field(buffers, tid, PAIR_XV_AVG);
+        float* __restrict out_vy = pair_field(buffers, tid, PAIR_YV_AVG);
+        float* __restrict out_n = pair_field(buffers, tid, PAIR_N_NEIGHBOURS);
+        float* __restrict out_dx = pair_field(buffers, tid, PAIR_CLOSE_DX);
+        float* __restrict out_dy = pair_field(buffers, tid, PAIR_CLOSE_DY);
+        float* __restrict out_z = nullptr;
+        float* __restrict out_vz = nullptr;
+        float* __restrict out_dz = nullptr;
+        if constexpr (Layout::D == 3) {
+            out_z = pair_field(buffers, tid, PAIR_Z_AVG);
+            out_vz = pair_field(buffers, tid, PAIR_ZV_AVG);
+            out_dz = pair_field(buffers, tid, PAIR_CLOSE_DZ);
+        }
+
+        float x_avg = 0.0f, y_avg = 0.0f, xv_avg = 0.0f, yv_avg = 0.0f;
+        float n_neighbours = 0.0f, close_dx = 0.0f, close_dy = 0.0f;
+        float z_avg = 0.0f, zv_avg = 0.0f, close_dz = 0.0f;
+
+        // The j are all different, so the scattered stores of a vector never collide
+#pragma omp simd reduction(+:close_dx, close_dy, close_dz, xv_avg, yv_avg, zv_avg, x_avg, y_avg, z_avg, n_neighbours)
+        for (int j = first; j < last; j++) {
+            float xj = Layout::x(b, j);
+            float yj = Layout::y(b, j);
+            float dx = xi - xj;
+            float dy = yi - yj;
+            float dist_sq = dx*dx + dy*dy;
+            float zj = 0.0f, dz = 0.0f;
+            if constexpr (Layout::D == 3) {
+                zj = Layout::z(b, j);
+                dz = zi - zj;
+                dist_sq += dz*dz;
+            }
+
+            float is_protected = (dist_sq < P::SQ_PROTECTED_RANGE) ? 1.0f : 0.0f;
+            float is_alignment = ((dist_sq < P::SQ_VISUAL_RANGE) ? 1.0f : 0.0f) - is_protected;
+
+            close_dx += dx * is_protected;
+            close_dy += dy * is_protected;
+            out_dx[j] -= dx * is_protected;
+            out_dy[j] -= dy * is_protected;
+
+            xv_avg += Layout::vx(b, j) * is_alignment;
+            yv_avg += Layout::vy(b, j) * is_alignment;
+            x_avg  += xj * is_alignment;
+            y_avg  += yj * is_alignment;
+            n_neighbours += is_alignment;
+            out_vx[j] += vxi * is_alignment;
+            out_vy[j] += vyi * is_alignment;
+            out_x[j] += xi * is_alignment;
+            out_y[j] += yi * is_alignment;
+            out_n[j] += is_alignment;
+
+            if constexpr (Layout::D == 3) {
+                close_dz += dz * is_protected;
+                out_dz[j] -= dz * is_protected;
+                zv_avg += Layout::vz(b, j) * is_alignment;
+                z_avg  += zj * is_alignment;
+                out_vz[j] += vzi * is_alignment;
+                out_z[j] += zi * is_alignment;
+            }
+        }
+
+        acc.x_avg += x_avg;
+        acc.y_avg += y_avg;
+        acc.xv_avg += xv_avg;
+        acc.yv_avg += yv_avg;
+        acc.n_neighbours += n_neighbours;
+        acc.close_dx += close_dx;
+        acc.close_dy += close_dy;
+        if constexpr (Layout::D == 3) {
+            acc.z_avg += z_avg;
+            acc.zv_avg += zv_avg;
+            acc.close_dz += close_dz;
+        }
+    }
+};
+
+/**
+ * Symmetric version of accumulate_neighbours: the boid i in (xi, yi, zi) with velocity (vxi, vyi, vzi)
+ * meets every boid j in [first, last), with j > i, once. The contribution of j on i goes in acc, the one
+ * of i on j (the same with the sign of dx/dy/dz flipped) is scattered in the buffer of the calling thread.
+ **/
+template<class Layout, class Exec>
+inline void accumulate_pairs(const typename Layout::Storage& b, int first, int last,
+                             float xi, float yi, float zi, float vxi, float vyi, float vzi,
+                             Neighbourhood& acc, PairBuffers& buffers) {
+    using P = typename Exec::Parameters;
+    const int tid = omp_get_thread_num();
+
+    if constexpr (Exec::SIMD) {
+        run_simd_loop<PairsLoop<Layout, P>>(b, first, last, xi, yi, zi, vxi, vyi, vzi, acc, buffers, tid);
+    } else {
+        float* __restrict out_x = pair_field(buffers, tid, PAIR_X_AVG);
+        float* __restrict out_y = pair_field(buffers, tid, PAIR_Y_AVG);
+        float* __restrict out_vx = pair_field(buffers, tid, PAIR_XV_AVG);
+        float* __restrict out_vy = pair_field(buffers, tid, PAIR_YV_AVG);
+        float* __restrict out_n = pair_field(buffers, tid, PAIR_N_NEIGHBOURS);
+        float* __restrict out_dx = pair_field(buffers, tid, PAIR_CLOSE_DX);
+        float* __restrict out_dy = pair_field(buffers, tid, PAIR_CLOSE_DY);
+        float* __restrict out_z = nullptr;
+        float* __restrict out_vz = nullptr;
+        float* __restrict out_dz = nullptr;
+        if constexpr (Layout::D == 3) {
+            out_z = pair_field(buffers, tid, PAIR_Z_AVG);
+            out_vz = pair_field(buffers, tid, PAIR_ZV_AVG);
+            out_dz = pair_field(buffers, tid, PAIR_CLOSE_DZ);
+        }
+
+        for (int j = first; j < last; j++) {
+
+            float dx = xi - Layout::x(b, j);
+            float dy = yi - Layout::y(b, j);
+            float dz = Layout::D == 3 ? zi - layout_z<Layout>(b, j) : 0.0f;
+
+            if (std::fabs(dx) < P::VISUAL_RANGE && std::fabs(dy) < P::VISUAL_RANGE && std::fabs(dz) < P::VISUAL_RANGE) {
+
+                float sqd = dx*dx + dy*dy;
+                if constexpr (Layout::D == 3)
+                    sqd += dz*dz;
+
+                if (sqd < P::SQ_PROTECTED_RANGE) {
+                    acc.close_dx += dx;
+                    acc.close_dy += dy;
+                    out_dx[j] -= dx;
+                    out_dy[j] -= dy;
+                    if constexpr (Layout::D == 3) {
+                        acc.close_dz += dz;
+                        out_dz[j] -= dz;
+                    }
+                } else if (sqd < P::SQ_VISUAL_RANGE) {
+                    acc.x_avg += Layout::x(b, j);
+                    acc.y_avg += Layout::y(b, j);
+                    acc.xv_avg += Layout::vx(b, j);
+                    acc.yv_avg += Layout::vy(b, j);
+                    acc.n_neighbours++;
+                    out_x[j] += xi;
+                    out_y[j] += yi;
+                    out_vx[j] += vxi;
+                    out_vy[j] += vyi;
+                    out_n[j]++;
+                    if constexpr (Layout::D == 3) {
+                        acc.z_avg += Layout::z(b, j);
+                        acc.zv_avg += Layout::vz(b, j);
+                        out_z[j] += zi;
+                        out_vz[j] += vzi;
+                    }
+                }
+            }
+        }
+    }
+}
+
+// Adds what the row of boid i gathered to its own entry of the thread buffer
+inline void scatter_row(PairBuffers& buffers, int i, const Neighbourhood& acc) {
+    const int tid = omp_get_thread_num();
+    pair_field(buffers, tid, PAIR_X_AVG)[i] += acc.x_avg;
+    pair_field(buffers, tid, PAIR_Y_AVG)[i] += acc.y_avg;
+    pair_field(buffers, tid, PAIR_XV_AVG)[i] += acc.xv_avg;
+    pair_field(buffers, tid, PAIR_YV_AVG)[i] += acc.yv_avg;
+    pair_field(buffers, tid, PAIR_N_NEIGHBOURS)[i] += acc.n_neighbours;
+    pair_field(buffers, tid, PAIR_CLOSE_DX)[i] += acc.close_dx;
+    pair_field(buffers, tid, PAIR_CLOSE_DY)[i] += acc.close_dy;
+    if (buffers.fields == PAIR_FIELDS) {
+        pair_field(buffers, tid, PAIR_Z_AVG)[i] += acc.z_avg;
+        pair_field(buffers, tid, PAIR_ZV_AVG)[i] += acc.zv_avg;
+        pair_field(buffers, tid, PAIR_CLOSE_DZ)[i] += acc.close_dz;
+    }
+}
+
+/**
+ * Symmetric frame (--symmetric), called inside the parallel region of step().
+ * All-pairs: row i meets [i+1, N). The rows get shorter, so row r and row N-1-r are given to the
+ * same iteration and the static schedule stays balanced.
+ * Grid: in binned order the cells of a row are contiguous, so the half of the 3x3 block after the
+ * boid is two ranges: the rest of its row up to the cell on the right, and the 3 cells of the row below.
+ * In 3D the layers follow each other, so the half of the 3x3x3 block adds the 3 rows of the next layer.
+ * Then every boid reduces the buffers of the team, steers and is stored as in the full version.
+ **/
+template<class Layout, class Exec>
+inline void step_symmetric(Simulation<Layout>& sim) {
+    const int N = sim.N;
+    Grid<Layout>& grid = sim.grid;
+    const typename Layout::Storage& b = sim.use_grid ? grid.binned : sim.boids;
+
+    clear_pair_buffer(sim.pairs, N);
+
+    auto row = [&](int i) {
+        const float xi = Layout::x(b, i);
+        const float yi = Layout::y(b, i);
+        const float zi = layout_z<Layout>(b, i);
+        const float vxi = Layout::vx(b, i);
+        const float vyi = Layout::vy(b, i);
+        const float vzi = layout_vz<Layout>(b, i);
+        Neighbourhood acc;
+
+        if (sim.use_grid) {
+            const int cell = grid_cell(grid, xi, yi, zi);
+            const int cx = cell % grid.cols;
+            const int cy = cell / grid.cols % grid.rows;
+            const int cz = cell / (grid.cols * grid.rows);
+            const int col_first = std::max(cx - 1, 0);
+            const int col_last = std::min(cx + 1, grid.cols - 1);
+            const int layer = cz * grid.rows; // first row of the layer
+
+            accumulate_pairs<Layout, Exec>(b, i + 1, grid.cell_start[(layer + cy) * grid.cols + col_last + 1],
+                                           xi, yi, zi, vxi, vyi, vzi, acc, sim.pairs);
+            if (cy + 1 < grid.rows) {
+                accumulate_pairs<Layout, Exec>(b,
+                                               grid.cell_start[(layer + cy + 1) * grid.cols + col_first],
+                                               grid.cell_start[(layer + cy + 1) * grid.cols + col_last + 1],
+                                               xi, yi, zi, vxi, vyi, vzi, acc, sim.pairs);
+            }
+            if constexpr (Layout::D == 3) {
+                if (cz + 1 < grid.layers) {
+                    for (int row = std::max(cy - 1, 0); row <= std::min(cy + 1, grid.rows - 1); row++) {
+                        const int run = (layer + grid.rows + row) * grid.cols;
+                        accumulate_pairs<Layout, Exec>(b, grid.cell_start[run + col_first],
+                                                       grid.cell_start[run + col_last + 1],
+                                                       xi, yi, zi, vxi, vyi, vzi, acc, sim.pairs);
+                    }
+                }
+            }
+        } else {
+            accumulate_pairs<Layout, Exec>(b, i + 1, N, xi, yi, zi, vxi, vyi, vzi, acc, sim.pairs);
+        }
+
+        scatter_row(sim.pairs, i, acc);
+    };
+
+    // Busy time of the two loops, without the waits at their barriers
+    const int tid = omp_get_thread_num();
+    auto busy_start = std::chrono::steady_clock::now();
+
+#pragma omp for schedule(static) nowait
+    for (int r = 0; r < (N + 1) / 2; r++) {
+        row(r);
+        if (N - 1 - r != r)
+            row(N - 1 - r);
+    }
+
+    sim.busy_ns[tid] += std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::steady_clock::now() - busy_start).count();
+#pragma omp barrier
+    busy_start = std::chrono::steady_clock::now();
+
+    const int n_threads = omp_get_num_threads();
+
+#pragma omp for schedule(static) nowait
+    for (int i = 0; i < N; i++) {
+        float xi = Layout::x(b, i);
+        float yi = Layout::y(b, i);
+        float zi = layout_z<Layout>(b, i);
+        float vxi = Layout::vx(b, i);
+        float vyi = Layout::vy(b, i);
+        float vzi = layout_vz<Layout>(b, i);
+
+        steer<Layout::D, typename Exec::Parameters>(xi, yi, zi, vxi, vyi, vzi,
+                                                     reduce_pair_buffers(sim.pairs, n_threads, i));
+
+        store_boid<Layout>(sim.boids_next, sim.use_grid ? grid.order[i] : i, xi + vxi, yi + vyi, zi + vzi, vxi, vyi, vzi);
+    }
+
+    sim.busy_ns[tid] += std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::steady_clock::now() - busy_start).count();
+}
+
+/**
+ * Cache-blocked all-pairs frame (--block), called inside the parallel region of step().
+ * Every thread takes blocks of `block` i boids and sweeps the j boids one tile of the same size at a
+ * time: a tile is loaded from memory once and reused by every i of the block while it is in cache,
+ * instead of streaming the whole arrays once per boid. The sums of the block live in a small
+ * per-thread array of Neighbourhood (sim.tile_acc, allocated once) until the last tile.
+ **/
+template<class Layout, class Exec>
+inline void step_tiled(Simulation<Layout>& sim) {
+    const int N = sim.N;
+    const int B = sim.block;
+    const int n_blocks = (N + B - 1) / B;
+    const typename Layout::Storage& b = sim.boids;
+    const int tid = omp_get_thread_num();
+    Neighbourhood* acc = sim.tile_acc.data() + (size_t)tid * B;
+    const auto busy_start = std::chrono::steady_clock::now();
+
+#pragma omp for schedule(static) nowait
+    for (int ib = 0; ib < n_blocks; ib++) {
+        const int i_first = ib * B;
+        const int i_last = std::min(i_first + B, N);
+        std::fill(acc, acc + B, Neighbourhood{});
+
+        for (int j_first = 0; j_first < N; j_first += B) {
+            const int j_last = std::min(j_first + B, N);
+            for (int i = i_first; i < i_last; i++)
+                accumulate_neighbours<Layout, Exec>(b, j_first, j_last, Layout::x(b, i), Layout::y(b, i),
+                                                    layout_z<Layout>(b, i), acc[i - i_first], sim.kernel.fn);
+        }
+
+        for (int i = i_first; i < i_last; i++) {
+            float xi = Layout::x(b, i);
+            float yi = Layout::y(b, i);
+            float zi = layout_z<Layout>(b, i);
+            float vxi = Layout::vx(b, i);
+            float vyi = Layout::vy(b, i);
+            float vzi = layout_vz<Layout>(b, i);
+
+            steer<Layout::D, typename Exec::Parameters>(xi, yi, zi, vxi, vyi, vzi, acc[i - i_first]);
+
+            store_boid<Layout>(sim.boids_next, i, xi + vxi, yi + vyi, zi + vzi, vxi, vyi, vzi);
+        }
+    }
+
+    sim.busy_ns[tid] += std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::steady_clock::now() - busy_start).count();
+}
+
+// Original index of the boid visited at position s of the frame loop
+template<class Layout>
+inline int boid_at(const Simulation<Layout>& sim, int s) {
+    if (sim.use_grid)
+        return sim.grid.order[s];
+    if (sim.use_verlet)
+        return sim.verlet.grid.order[s]; // rows of the lists
+    return s;
+}
+
+/**
+ * Neighbours, steering and store of the boid visited at position s of the frame loop (binned order
+ * with the grid, row of the lists with Verlet, original order otherwise). The cost of the boid is kept for the balanced schedule
+ * of the next frame: boids scanned plus HIT_WEIGHT for every neighbour, because the branchy loop does
+ * the real work only for the boids passing the fabs test (the branchless one doesn't care).
+ **/
+template<class Layout, class Exec>
+inline void update_boid(Simulation<Layout>& sim, int s) {
+    constexpr float HIT_WEIGHT = Exec::SIMD ? 0.0f : 3.0f;
+    const Grid<Layout>& grid = sim.grid;
+    const typename Layout::Storage& b = sim.use_grid ? grid.binned : sim.boids;
+    const int i = boid_at(sim, s);
+    const int self = sim.use_grid ? s : i; // where the boid is read
+
+    float xi = Layout::x(b, self);
+    float yi = Layout::y(b, self);
+    float zi = layout_z<Layout>(b, self);
+    float vxi = Layout::vx(b, self);
+    float vyi = Layout::vy(b, self);
+    float vzi = layout_vz<Layout>(b, self);
+    Neighbourhood acc;
+    int scanned;
+
+    if (sim.use_grid) {
+        //To compare the boid only with the ones in the 3x3 (3x3x3) neighbouring cells
+        scanned = 0;
+        for_each_block_range(grid, grid_cell(grid, xi, yi, zi), [&](int first, int last) {
+            accumulate_neighbours<Layout, Exec>(b, first, last, xi, yi, zi, acc, sim.kernel.fn);
+            scanned += last - first;
+        });
+    } else if (sim.use_verlet) {
+        //To compare the boid only with the candidates of its list
+        const int first = sim.verlet.row_start[s];
+        const int last = sim.verlet.row_start[s + 1];
+        accumulate_candidates<Layout, Exec>(b, sim.verlet.candidates.data(), first, last, xi, yi, zi, acc);
+        scanned = last - first;
+    } else {
+        //To compare every boid with everyone else
+        accumulate_neighbours<Layout, Exec>(b, 0, sim.N, xi, yi, zi, acc, sim.kernel.fn);
+        scanned = sim.N;
+    }
+
+    // Written back at the original index, the boids keep their identity
+    sim.cost[i] = scanned + HIT_WEIGHT * acc.n_neighbours;
+
+    steer<Layout::D, typename Exec::Parameters>(xi, yi, zi, vxi, vyi, vzi, acc);
+
+    store_boid<Layout>(sim.boids_next, i, xi + vxi, yi + vyi, zi + vzi, vxi, vyi, vzi);
+}
+
+/**
+ * Balanced schedule: contiguous ranges of the frame loop with the same estimated cost (from the
+ * previous frame) for every thread, instead of the same number of boids. Called by every thread
+ * of the team, one of them splits the prefix sum of the costs.
+ **/
+template<class Layout>
+inline void balance_partition(Simulation<Layout>& sim) {
+#pragma omp single
+    {
+        const int N = sim.N;
+        const int n_threads = omp_get_num_threads();
+        auto cost_at = [&sim](int s) { return sim.cost[boid_at(sim, s)]; };
+
+        double total = 0.0;
+        for (int s = 0; s < N; s++)
+            total += cost_at(s);
+
+        int t = 1;
+        double running = 0.0;
+        sim.bounds[0] = 0;
+        for (int s = 0; s < N && t < n_threads; s++) {
+            running += cost_at(s);
+            while (t < n_threads && running >= total * t / n_threads)
+                sim.bounds[t++] = s + 1;
+        }
+        while (t <= n_threads)
+            sim.bounds[t++] = N;
+    }
+}
+
+// One frame: reads sim.boids, writes sim.boids_next and swaps them
+template<class Layout, class Exec>
+inline void step(Simulation<Layout>& sim) {
+    const int N = sim.N;
+
+    // --- Parallel Region ---
+#pragma omp parallel if(Exec::PARALLEL) default(none) shared(N, sim)
+    {
+        if (sim.use_grid)
+            build_grid(sim.grid, sim.boids, N);
+        if (sim.use_verlet)
+            update_verlet(sim.verlet, sim.boids, N);
+
+        if (sim.symmetric) {
+            step_symmetric<Layout, Exec>(sim);
+        } else if (sim.block > 0) {
+            step_tiled<Layout, Exec>(sim);
+        } else {
+            const int tid = omp_get_thread_num();
+            if (sim.schedule == Schedule::BALANCED)
+                balance_partition(sim);
+
+            // Time of this thread until its last boid, without the wait at the final barrier
+            const auto busy_start = std::chrono::steady_clock::now();
+
+            // With the grid the boids are visited in binned order, so consecutive boids share the same cells
+            if (sim.schedule == Schedule::BALANCED) {
+                for (int s = sim.bounds[tid]; s < sim.bounds[tid + 1]; s++)
+                    update_boid<Layout, Exec>(sim, s);
+            } else if (sim.schedule == Schedule::DYNAMIC) {
+#pragma omp for schedule(dynamic, DYNAMIC_CHUNK) nowait
+                for (int s = 0; s < N; s++)
+                    update_boid<Layout, Exec>(sim, s);
+            } else {
+#pragma omp for schedule(static) nowait
+                for (int s = 0; s < N; s++)
+                    update_boid<Layout, Exec>(sim, s);
+            }
+
+            sim.busy_ns[tid] += std::chrono::duration_cast<std::chrono::nanoseconds>(
+                    std::chrono::steady_clock::now() - busy_start).count();
+        }
+    }
+
+    std::swap(sim.boids, sim.boids_next);
+}
+
+// Space-filling-curve sort of the storage every reordering.every frames (see Reorder.h)
+template<class Layout>
+inline void reorder_if_due(Simulation<Layout>& sim, int frame) {
+    if (sim.reordering.every > 0 && frame % sim.reordering.every == 0) {
+        reorder_boids<Layout>(sim.reordering, sim.boids, sim.boids_next, sim.N, sim.id_of, sim.slot_of, sim.cost);
+        sim.verlet.valid = false; // the lists hold storage indices
+    }
+}
@@ -0,0 +1,142 @@
+//
+// Created by giacomo on 03/02/26.
+//
+
+#pragma once //to include the file only once
+
+#include <cstdint>
+#include <string>
+#include <iostream>
+#include <vector>
+
+/**
+ * Execution parameters injected via command line (or by the python scripts), shared by every version.
+ * The front-ends only change the defaults before calling parse().
+ **/
+
+struct Config {
+
+    int N = 1000;
+    int frames = 300;
+    int threads = 8;
+    std::string csv;
+    bool headless = false; // no window, no graphics and no frame rate limit
+    std::string neighbours = "all"; // "all" compares every pair, "grid" uses the uniform grid, "verlet" the Verlet lists
+    float skin = 16.0f;             // extra radius of the Verlet lists (px)
+    int dims = 3;                   // dimensions of the flock, only SOA_3D (see AlignedSoaLayout3D)
+    std::string kernel = "auto"; // "auto", "avx512", "avx2", "sse42" or "omp_simd" (see Kernels_SIMD.h)
+    std::string snapshot; // binary snapshot written at the end of the run (see Snapshot.h)
+    int snapshot_every = 0; // and also every k frames, if > 0
+    std::string restore;  // snapshot to start from instead of the random initialization
+    uint64_t seed = 0;      // initial flock, the same seed gives the same flock with any number of threads
+    bool seed_set = false;  // without --seed every run is different
+    bool symmetric = false; // every pair evaluated once, with per-thread accumulation buffers (see Pair_buffers.h)
+    int block = 0;          // tile size of the all-pairs traversal in boids, 0 = not tiled, -1 = sized from the L2 cache
+    std::string storage = "fp32"; // "fp32" or "int16" (fixed point, only SOA_parallel_SIMD, see SOA_helper_int16.h)
+    bool drift = false;     // with a reduced precision storage, runs the fp32 path alongside and reports the drift
+    std::string affinity = "none"; // "none", "close" or "spread": pins the OpenMP threads (see Numa.h)
+    std::string schedule = "static"; // "static", "balanced" (from the cost of the last frame) or "dynamic"
+    int reorder_every = 0;  // storage sorted along a space-filling curve every k frames, 0 = never (see Reorder.h)
+    std::string curve = "hilbert"; // "hilbert" or "morton"
+    std::string trajectory; // compressed trajectories written by a background thread (see Trajectory_writer.h)
+    int trajectory_every = 1; // one recorded frame every k
+    std::string params;             // parameter file of the model, "NAME = value" lines (see Flock_params.h)
+    std::vector<std::string> param; // single NAME=value assignments, applied after the file
+    int ensemble = 0;       // M independent flocks in one process, 0 = a single flock (see Ensemble.h)
+    std::string sweep;      // NAME=v1,v2,...: parameter of the ensemble members, member m gets the value m % k
+    bool counters = false;  // hardware counters around the parallel region of the frame (see Perf_counters.h)
+    bool pipeline = false;  // render on a separate thread while the next frame is computed (see Render_pipeline.h)
+
+
+    //Parsing params passed via command line
+    void parse(int argc, char* argv[]) {
+        for (int i = 1; i < argc; ++i) { //i = 1 because for i=0 we always have the exe path
+            std::string arg = argv[i];
+            if (arg == "--N" && i + 1 < argc) {
+                N = std::stoi(argv[++i]);
+            } else if (arg == "--frames" && i + 1 < argc) {
+                frames = std::stoi(argv[++i]);
+            } else if (arg == "--threads" && i + 1 < argc) {
+                threads = std::stoi(argv[++i]);
+            } else if (arg == "--csv" && i + 1 < argc) {
+                csv = argv[++i];
+            } else if (arg == "--headless") {
+                headless = true;
+            } else if (arg == "--neighbours" && i + 1 < argc) {
+                neighbours = argv[++i];
+            } else if (arg == "--kernel" && i + 1 < argc) {
+                kernel = argv[++i];
+            } else if (arg == "--snapshot" && i + 1 < argc) {
+                snapshot = argv[++i];
+            } else if (arg == "--snapshot-every" && i + 1 < argc) {
+                snapshot_every = std::stoi(argv[++i]);
+            } else if (arg == "--restore" && i + 1 < argc) {
+                restore = argv[++i];
+            } else if (arg == "--seed" && i + 1 < argc) {
+                seed = std::stoull(argv[++i]);
+                seed_set = true;
+            } else if (arg == "--symmetric") {
+                symmetric = true;
+            } else if (arg == "--block" && i + 1 < argc) {
+                const std::string value = argv[++i];
+                block = value == "auto" ? -1 : std::stoi(value);
+            } else if (arg == "--storage" && i + 1 < argc) {
+                storage = argv[++i];
+            } else if (arg == "--drift") {
+                drift = true;
+            } else if (arg == "--affinity" && i + 1 < argc) {
+                affinity = argv[++i];
+            } else if (arg == "--schedule" && i + 1 < argc) {
+                schedule = argv[++i];
+            } else if (arg == "--reorder" && i + 1 < argc) {
+                reorder_every = std::stoi(argv[++i]);
+            } else if (arg == "--curve" && i + 1 < argc) {
+                curve = argv[++i];
+            } else if (arg == "--dims" && i + 1 < argc) {
+                dims = std::stoi(argv[++i]);
+            } else if (arg == "--skin" && i + 1 < argc) {
+                skin = std::stof(argv[++i]);
+            } else if (arg == "--trajectory" && i + 1 < argc) {
+                trajectory = argv[++i];
+            } else if (arg == "--trajectory-every" && i + 1 < argc) {
+                trajectory_every = std::stoi(argv[++i]);
+            } else if (arg == "--params" && i + 1 < argc) {
+                params = argv[++i];
+            } else if (arg == "--param" && i + 1 < argc) {
+                param.push_back(argv[++i]);
+            } else if (arg == "--ensemble" && i + 1 < argc) {
+                ensemble = std::stoi(argv[++i]);
+            } else if (arg == "--sweep" && i + 1 < argc) {
+                sweep = argv[++i];
+            } else if (arg == "--counters") {
+                counters = true;
+            } else if (arg == "--pipeline") {
+                pipeline = true;
+            }
+            else {
+                std::cerr << "Unknown argument: " << arg << std::endl;
+            }
+        }
+    }
+
+    void print() const {
+        std::cout << "Config: N=" << N
+                  << ", frames=" << frames
+                  << ", threads=" << threads
+                  << ", headless=" << headless
+                  << ", neighbours=" << neighbours
+                  << ", skin=" << skin
+                  << ", kernel=" << kernel
+                  << ", symmetric=" << symmetric
+                  << ", block=" << block
+                  << ", storage=" << storage
+                  << ", affinity=" << affinity
+                  << ", schedule=" << schedule
+                  << ", reorder=" << reorder_every
+                  << ", pipeline=" << pipeline
+                  << ", ensemble=" << ensemble
+                  << ", counters=" << counters
+                  << ", trajectory=" << (trajectory.empty() ? "off" : trajectory)
+                  << std::endl;
+    }
+};
@@ -0,0 +1,40 @@
+//
+// Created by giacomo on 13/02/26.
+//
+
+#pragma once //to include the file only once
+
+#include <cstdint>
+
+/**
+ * Counter-based random numbers (Squares, B. Widynski 2020): the value is a pure function of
+ * (key, counter), there is no generator state. Every boid draws its numbers from counters derived
+ * from its own index, so the initialization can run in parallel without races and gives the
+ * same flock for the same seed whatever the number of threads.
+ **/
+
+// The key must have well mixed bits: the seed goes through splitmix64 and is made odd
+inline uint64_t squares_key(uint64_t seed) {
+    uint64_t z = seed + 0x9E3779B97F4A7C15ULL;
+    z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+    z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+    z = z ^ (z >> 31);
+    return z | 1;
+}
+
+inline uint32_t squares32(uint64_t counter, uint64_t key) {
+    uint64_t x = counter * key;
+    const uint64_t y = x;
+    const uint64_t z = y + key;
+
+    x = x * x + y; x = (x >> 32) | (x << 32);
+    x = x * x + z; x = (x >> 32) | (x << 32);
+    x = x * x + y; x = (x >> 32) | (x << 32);
+    return (uint32_t)((x * x + z) >> 32);
+}
+
+// Uniform float in [min, max) from the 24 high bits (the mantissa of a float)
+inline float counter_uniform(uint64_t key, uint64_t counter, float min, float max) {
+    const float u = (float)(squares32(counter, key) >> 8) * (1.0f / 16777216.0f);
+    return min + (max - min) * u;
+}
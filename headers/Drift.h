@@ -0,0 +1,129 @@
+//
+// Created by giacomo on 17/02/26.
+//
+
+#pragma once //to include the file only once
+
+#include "Boids_engine.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <iostream>
+#include <vector>
+
+/**
+ * Drift of a reduced precision layout from the fp32 path (--drift).
+ * The layouts that approximate another one name it as Layout::Reference. The reference simulation
+ * starts from the same (already rounded) flock and runs the same neighbour search next to the real
+ * one, outside the frame timing; after every frame the distance between the two flocks is measured.
+ * The flocking is chaotic, so the drift grows with the frames anyway: the numbers are printed at
+ * frames 1, 10, 100, ... and at the last one, to see how fast it grows.
+ **/
+
+template<class Layout>
+concept HasReference = requires { typename Layout::Reference; };
+
+struct DriftSample {
+    long long frame = 0;
+    double pos_rms = 0.0, pos_max = 0.0; // px
+    double vel_rms = 0.0, vel_max = 0.0;
+};
+
+template<class A, class B>
+inline DriftSample measure_drift(const typename A::Storage& a, const int* slot_of,
+                                 const typename B::Storage& b, int N, long long frame) {
+    double pos_sq = 0.0, vel_sq = 0.0, pos_max = 0.0, vel_max = 0.0;
+
+#pragma omp parallel for schedule(static) reduction(+:pos_sq, vel_sq) reduction(max:pos_max, vel_max)
+    for (int i = 0; i < N; i++) {
+        const int slot = slot_of[i]; // the reference is never reordered, compared boid by boid
+        const double dx = A::x(a, slot) - B::x(b, i);
+        const double dy = A::y(a, slot) - B::y(b, i);
+        const double dvx = A::vx(a, slot) - B::vx(b, i);
+        const double dvy = A::vy(a, slot) - B::vy(b, i);
+        const double pos = dx*dx + dy*dy;
+        const double vel = dvx*dvx + dvy*dvy;
+
+        pos_sq += pos;
+        vel_sq += vel;
+        pos_max = std::max(pos_max, pos);
+        vel_max = std::max(vel_max, vel);
+    }
+
+    DriftSample sample;
+    sample.frame = frame;
+    sample.pos_rms = std::sqrt(pos_sq / std::max(N, 1));
+    sample.vel_rms = std::sqrt(vel_sq / std::max(N, 1));
+    sample.pos_max = std::sqrt(pos_max);
+    sample.vel_max = std::sqrt(vel_max);
+    return sample;
+}
+
+inline void print_drift(const std::vector<DriftSample>& samples) {
+    for (const DriftSample& s : samples) {
+        printf("Drift vs fp32 at frame %lld: position rms %.4f max %.4f px, velocity rms %.5f max %.5f\n",
+               s.frame, s.pos_rms, s.pos_max, s.vel_rms, s.vel_max);
+    }
+}
+
+// Layouts without a reference: --drift has nothing to compare with
+template<class Layout, class Exec>
+struct DriftTracker {
+    void start(const Config& cfg, const Simulation<Layout>&) {
+        if (cfg.drift)
+            std::cerr << "Warning: --drift needs a reduced precision storage (--storage int16)" << std::endl;
+    }
+    void after_step(const Simulation<Layout>&, int) {}
+    void finish() {}
+};
+
+template<class Layout, class Exec> requires HasReference<Layout>
+struct DriftTracker<Layout, Exec> {
+    using Reference = typename Layout::Reference;
+
+    bool active = false;
+    Simulation<Reference> reference{};
+    std::vector<DriftSample> samples;
+    DriftSample last;
+    long long next_report = 1;
+
+    void start(Config cfg, const Simulation<Layout>& sim) {
+        active = cfg.drift;
+        if (!active)
+            return;
+
+        cfg.kernel = "omp_simd"; // the same loop of the real simulation, only the storage differs
+        reference = allocate_simulation<Reference, Exec>(cfg);
+
+#pragma omp parallel for schedule(static)
+        for (int i = 0; i < sim.N; i++) {
+            const int slot = sim.slot_of[i];
+            Reference::store(reference.boids, i, Layout::x(sim.boids, slot), Layout::y(sim.boids, slot),
+                             Layout::vx(sim.boids, slot), Layout::vy(sim.boids, slot));
+        }
+    }
+
+    void after_step(const Simulation<Layout>& sim, int frame) {
+        if (!active)
+            return;
+
+        step<Reference, Exec>(reference);
+        last = measure_drift<Layout, Reference>(sim.boids, sim.slot_of.data(), reference.boids, sim.N, frame);
+
+        if (frame == next_report) {
+            samples.push_back(last);
+            next_report *= 10;
+        }
+    }
+
+    void finish() {
+        if (!active)
+            return;
+
+        if (last.frame > (samples.empty() ? 0 : samples.back().frame))
+            samples.push_back(last);
+        print_drift(samples);
+        free_simulation(reference);
+    }
+};
@@ -0,0 +1,511 @@
+//
+// Created by giacomo on 25/02/26.
+//
+
+#pragma once //to include the file only once
+
+#include "Boids_engine.h"
+#include "Frame_stats.h"
+#include "Snapshot.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <omp.h>
+
+/**
+ * Ensemble mode (--ensemble M): M independent flocks of N boids advanced together in one process,
+ * for statistics over seeds (member m starts from seed + m) or parameter studies (--sweep NAME=v1,v2,...,
+ * member m gets the value m % k of the list).
+ * The members live in one arena of the layout: member m is the index range [m * stride, m * stride + N),
+ * stride rounded to 8 boids so every member starts on a 32 byte boundary. The engine functions work
+ * on index ranges, so they run on the arena without copies; the parameters of a member are a
+ * MemberParams object passed to them (see Flock_params.h).
+ * One parallel region per frame:
+ *  - the counting sort by cell, one member per iteration (dynamic, members with a larger visual range
+ *    have fewer, fuller cells), serial inside the member; with fewer members than threads the members
+ *    are sorted one after the other, each by the whole team as in build_grid();
+ *  - the neighbours and the steering of all the M * N boids in a single static loop, so the threads
+ *    split the work across and within the members and a small flock doesn't leave them idle.
+ * The per-member observables (polarization, mean speed, neighbours per boid) go to <csv>.members.csv,
+ * one row per member with its seed and parameters; the usual csv row has the timing of the whole ensemble.
+ **/
+
+constexpr int ENSEMBLE_ALIGNMENT = 8; // boids, 32 bytes of floats
+
+// Cells of one member, sized with its own visual range. cell_start holds indices of the arena.
+struct MemberGrid {
+    int cols, rows;
+    float cell_size;
+    std::vector<int> cell_start; // cols*rows + 1 entries
+    std::vector<int> thread_offset; // n_threads * cols*rows entries, for the parallel sort
+};
+
+template<class Layout>
+struct Ensemble {
+    int members;
+    int N;
+    int stride;
+    bool use_grid;
+    KernelInfo kernel;
+
+    typename Layout::Storage boids;      // members * stride boids
+    typename Layout::Storage boids_next;
+    typename Layout::Storage binned;     // every member sorted by cell inside its own range
+    std::vector<int> order;              // binned index -> arena index
+    std::vector<int> cell_of;            // cell of every boid (arena index)
+
+    std::vector<uint64_t> seeds;
+    std::vector<MemberParams> params;
+    std::vector<std::vector<float>> values; // parameters of every member in the order of param_entries(), for the csv
+    std::vector<MemberGrid> grids;
+
+    std::vector<double> thread_neighbours; // n_threads * members sums over the frames, added once per frame
+    std::vector<double> thread_scanned;
+};
+
+/**
+ * Parameters of the members: the values of RuntimeParams, with the swept one (if any) changed member
+ * by member. Every set is validated like the command line ones, RuntimeParams is left as it was.
+ **/
+inline void ensemble_params(const std::string& sweep, int members,
+                            std::vector<MemberParams>& params, std::vector<std::vector<float>>& values) {
+    std::string name;
+    std::vector<std::string> list;
+    if (!sweep.empty()) {
+        const size_t eq = sweep.find('=');
+        if (eq == std::string::npos) {
+            std::cerr << "Expected NAME=v1,v2,...: " << sweep << std::endl;
+            exit(EXIT_FAILURE);
+        }
+        name = sweep.substr(0, eq);
+        std::stringstream ss(sweep.substr(eq + 1));
+        std::string value;
+        while (std::getline(ss, value, ','))
+            list.push_back(value);
+        if (list.empty()) {
+            std::cerr << "No values to sweep: " << sweep << std::endl;
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    const std::vector<float> base = param_values();
+    for (int m = 0; m < members; m++) {
+        if (!list.empty()) {
+            set_param(name, list[m % list.size()]);
+            validate_params();
+            update_derived_params();
+        }
+        params.push_back(MemberParams{});
+        values.push_back(param_values());
+        set_param_values(base);
+    }
+}
+
+template<class Layout>
+inline Ensemble<Layout> allocate_ensemble(const Config& cfg) {
+    static_assert(Layout::D == 2, "the ensemble members are 2D flocks");
+    Ensemble<Layout> ens{};
+    ens.members = cfg.ensemble;
+    ens.N = cfg.N;
+    ens.stride = (cfg.N + ENSEMBLE_ALIGNMENT - 1) / ENSEMBLE_ALIGNMENT * ENSEMBLE_ALIGNMENT;
+    ens.use_grid = cfg.neighbours == "grid";
+    if constexpr (Layout::CONTIGUOUS)
+        ens.kernel = select_kernel(cfg.kernel);
+    else
+        ens.kernel = {"omp_simd", nullptr};
+
+    ensemble_params(cfg.sweep, ens.members, ens.params, ens.values);
+
+    const int total = ens.members * ens.stride;
+    ens.boids = Layout::allocate(total);
+    ens.boids_next = Layout::allocate(total);
+    ens.binned = Layout::allocate(total);
+    ens.order.assign(total, 0);
+    ens.cell_of.assign(total, 0);
+
+    for (int m = 0; m < ens.members; m++) {
+        const MemberParams& p = ens.params[m];
+        MemberGrid grid;
+        grid.cell_size = p.VISUAL_RANGE;
+        grid.cols = std::max(1, (int)std::ceil(p.X_SIZE / grid.cell_size));
+        grid.rows = std::max(1, (int)std::ceil(p.Y_SIZE / grid.cell_size));
+        grid.cell_start.assign(grid.cols * grid.rows + 1, 0);
+        if (ens.members < omp_get_max_threads())
+            grid.thread_offset.assign((size_t)omp_get_max_threads() * grid.cols * grid.rows, 0);
+        ens.grids.push_back(grid);
+    }
+
+    ens.thread_neighbours.assign((size_t)omp_get_max_threads() * ens.members, 0.0);
+    ens.thread_scanned.assign((size_t)omp_get_max_threads() * ens.members, 0.0);
+
+    // The padding of the members is never read, but the whole arena is first touched
+    first_touch<Layout>(ens.boids, total);
+    first_touch<Layout>(ens.boids_next, total);
+    first_touch<Layout>(ens.binned, total);
+
+    return ens;
+}
+
+template<class Layout>
+inline void free_ensemble(Ensemble<Layout>& ens) {
+    Layout::release(ens.boids);
+    Layout::release(ens.boids_next);
+    Layout::release(ens.binned);
+}
+
+// Member m starts from seed + m, with its own margins and speeds
+template<class Layout>
+inline void init_ensemble(Ensemble<Layout>& ens, uint64_t seed) {
+    for (int m = 0; m < ens.members; m++) {
+        ens.seeds.push_back(seed + m);
+        const uint64_t key = squares_key(seed + m);
+        const MemberParams& p = ens.params[m];
+        const int base = m * ens.stride;
+
+#pragma omp parallel for schedule(static) default(none) shared(ens, key, p, base)
+        for (int i = 0; i < ens.N; i++) {
+            float x, y, z, vx, vy, vz;
+            initial_boid<2>(key, i, x, y, z, vx, vy, vz, p);
+            Layout::store(ens.boids, base + i, x, y, vx, vy);
+        }
+    }
+}
+
+inline int member_cell(const MemberGrid& grid, float x, float y) {
+    const float fx = std::clamp(x / grid.cell_size, 0.0f, (float)(grid.cols - 1));
+    const float fy = std::clamp(y / grid.cell_size, 0.0f, (float)(grid.rows - 1));
+    return (int)fy * grid.cols + (int)fx;
+}
+
+// Serial counting sort of member m into its range of the binned arena, stable like build_grid()
+template<class Layout>
+inline void bin_member(Ensemble<Layout>& ens, int m) {
+    MemberGrid& grid = ens.grids[m];
+    const int cells = grid.cols * grid.rows;
+    const int base = m * ens.stride;
+    std::vector<int>& start = grid.cell_start;
+
+    std::fill(start.begin(), start.end(), 0);
+    for (int i = base; i < base + ens.N; i++) {
+        const int c = member_cell(grid, Layout::x(ens.boids, i), Layout::y(ens.boids, i));
+        ens.cell_of[i] = c;
+        start[c + 1]++;
+    }
+
+    start[0] = base;
+    for (int c = 0; c < cells; c++)
+        start[c + 1] += start[c];
+
+    // start[c] is moved to the end of cell c while scattering, then shifted back
+    for (int i = base; i < base + ens.N; i++) {
+        const int pos = start[ens.cell_of[i]]++;
+        ens.order[pos] = i;
+        Layout::copy(ens.binned, pos, ens.boids, i);
+    }
+    for (int c = cells; c > 0; c--)
+        start[c] = start[c - 1];
+    start[0] = base;
+}
+
+/**
+ * Parallel counting sort of member m, the same of build_grid() on the range of the member: called by
+ * every thread of the team, when there are fewer members than threads. Same result of bin_member().
+ **/
+template<class Layout>
+inline void bin_member_parallel(Ensemble<Layout>& ens, int m) {
+    MemberGrid& grid = ens.grids[m];
+    const int cells = grid.cols * grid.rows;
+    const int base = m * ens.stride;
+    const int tid = omp_get_thread_num();
+    int* offset = grid.thread_offset.data() + (size_t)tid * cells;
+
+    std::fill(offset, offset + cells, 0);
+
+#pragma omp for schedule(static)
+    for (int i = base; i < base + ens.N; i++) {
+        const int c = member_cell(grid, Layout::x(ens.boids, i), Layout::y(ens.boids, i));
+        ens.cell_of[i] = c;
+        offset[c]++;
+    }
+
+    // Exclusive scan cell by cell, inside a cell thread by thread, from the start of the member
+#pragma omp single
+    {
+        const int n_threads = omp_get_num_threads();
+        int running = base;
+        for (int c = 0; c < cells; c++) {
+            grid.cell_start[c] = running;
+            for (int t = 0; t < n_threads; t++) {
+                int count = grid.thread_offset[(size_t)t * cells + c];
+                grid.thread_offset[(size_t)t * cells + c] = running;
+                running += count;
+            }
+        }
+        grid.cell_start[cells] = running;
+    }
+
+#pragma omp for schedule(static)
+    for (int i = base; i < base + ens.N; i++) {
+        const int pos = offset[ens.cell_of[i]]++;
+        ens.order[pos] = i;
+        Layout::copy(ens.binned, pos, ens.boids, i);
+    }
+}
+
+/**
+ * Neighbours, steering and store of the boid at position s of the arena (binned order with the grid).
+ * Exec is the policy of the run with the parameters of the members. The neighbours found and the
+ * boids scanned are added to the sums of the caller, which are local to its thread.
+ **/
+template<class Layout, class Exec>
+inline void update_member_boid(Ensemble<Layout>& ens, int m, int s, double& neighbours_sum, double& scanned_sum) {
+    const MemberParams& p = ens.params[m];
+    const typename Layout::Storage& b = ens.use_grid ? ens.binned : ens.boids;
+    const int i = ens.use_grid ? ens.order[s] : s;
+
+    float xi = Layout::x(b, s);
+    float yi = Layout::y(b, s);
+    float vxi = Layout::vx(b, s);
+    float vyi = Layout::vy(b, s);
+    Neighbourhood acc;
+    int scanned;
+
+    if (ens.use_grid) {
+        const MemberGrid& grid = ens.grids[m];
+        const int cell = member_cell(grid, xi, yi);
+        const int cx = cell % grid.cols;
+        const int cy = cell / grid.cols;
+        const int col_first = std::max(cx - 1, 0);
+        const int col_last = std::min(cx + 1, grid.cols - 1);
+
+        scanned = 0;
+        for (int row = std::max(cy - 1, 0); row <= std::min(cy + 1, grid.rows - 1); row++) {
+            const int first = grid.cell_start[row * grid.cols + col_first];
+            const int last = grid.cell_start[row * grid.cols + col_last + 1];
+            accumulate_neighbours<Layout, Exec>(b, first, last, xi, yi, 0.0f, acc, ens.kernel.fn, p);
+            scanned += last - first;
+        }
+    } else {
+        const int base = m * ens.stride;
+        accumulate_neighbours<Layout, Exec>(b, base, base + ens.N, xi, yi, 0.0f, acc, ens.kernel.fn, p);
+        scanned = ens.N;
+    }
+
+    neighbours_sum += acc.n_neighbours;
+    scanned_sum += scanned;
+
+    float vzi = 0.0f;
+    steer<2>(xi, yi, 0.0f, vxi, vyi, vzi, acc, p);
+
+    Layout::store(ens.boids_next, i, xi + vxi, yi + vyi, vxi, vyi);
+}
+
+// One frame of every member: reads ens.boids, writes ens.boids_next and swaps them
+template<class Layout, class Exec>
+inline void step_ensemble(Ensemble<Layout>& ens) {
+    const long long total = (long long)ens.members * ens.N;
+
+#pragma omp parallel if(Exec::PARALLEL) default(none) shared(ens, total)
+    {
+        const int tid = omp_get_thread_num();
+
+        if (ens.use_grid) {
+            if (ens.members >= omp_get_num_threads()) {
+#pragma omp for schedule(dynamic, 1)
+                for (int m = 0; m < ens.members; m++)
+                    bin_member(ens, m);
+            } else {
+                for (int m = 0; m < ens.members; m++)
+                    bin_member_parallel(ens, m);
+            }
+        }
+
+        // The sums of the member being visited stay in registers and go to the slot of the thread
+        // when the member changes: a few writes per frame instead of one per boid (no false sharing)
+        int member = -1;
+        double neighbours = 0.0, scanned = 0.0;
+        auto flush = [&]() {
+            if (member >= 0) {
+                ens.thread_neighbours[(size_t)tid * ens.members + member] += neighbours;
+                ens.thread_scanned[(size_t)tid * ens.members + member] += scanned;
+            }
+            neighbours = scanned = 0.0;
+        };
+
+        // Across and within the members: boid k is boid k % N of member k / N
+#pragma omp for schedule(static) nowait
+        for (long long k = 0; k < total; k++) {
+            const int m = (int)(k / ens.N);
+            const int s = m * ens.stride + (int)(k % ens.N);
+            if (m != member) {
+                flush();
+                member = m;
+            }
+            update_member_boid<Layout, Exec>(ens, m, s, neighbours, scanned);
+        }
+        flush();
+    }
+
+    std::swap(ens.boids, ens.boids_next);
+}
+
+struct MemberResult {
+    double polarization; // length of the mean unit velocity, 1 when all the boids fly the same way
+    double mean_speed;
+    double neighbours;   // mean neighbours per boid over the frames
+    double scanned;      // boids scanned per frame
+};
+
+template<class Layout>
+inline std::vector<MemberResult> ensemble_results(const Ensemble<Layout>& ens, int frames) {
+    std::vector<MemberResult> results(ens.members);
+    const int n_threads = (int)(ens.thread_neighbours.size() / ens.members);
+
+    for (int m = 0; m < ens.members; m++) {
+        double ux = 0.0, uy = 0.0, speed = 0.0;
+        for (int i = m * ens.stride; i < m * ens.stride + ens.N; i++) {
+            const double vx = Layout::vx(ens.boids, i);
+            const double vy = Layout::vy(ens.boids, i);
+            const double v = std::sqrt(vx*vx + vy*vy);
+            speed += v;
+            if (v > 0.0) {
+                ux += vx / v;
+                uy += vy / v;
+            }
+        }
+
+        double neighbours = 0.0, scanned = 0.0;
+        for (int t = 0; t < n_threads; t++) {
+            neighbours += ens.thread_neighbours[(size_t)t * ens.members + m];
+            scanned += ens.thread_scanned[(size_t)t * ens.members + m];
+        }
+
+        MemberResult& r = results[m];
+        r.polarization = std::sqrt(ux*ux + uy*uy) / ens.N;
+        r.mean_speed = speed / ens.N;
+        r.neighbours = frames > 0 ? neighbours / ((double)frames * ens.N) : 0.0;
+        r.scanned = frames > 0 ? scanned / frames : 0.0;
+    }
+    return results;
+}
+
+// One row per member in <csv>.members.csv, with the header the first time the file is created
+template<class Layout>
+inline void append_members_csv(const std::string& csv_filename, const Ensemble<Layout>& ens, int frames,
+                               const std::vector<MemberResult>& results) {
+    if (csv_filename.empty())
+        return;
+
+    const std::string filename = csv_filename + ".members.csv";
+    const bool exists = std::ifstream(filename).good();
+    std::ofstream out(filename, std::ios::app);
+
+    if (!exists) {
+        out << "member,seed,N,frames";
+        for (const ParamEntry& e : param_entries())
+            out << "," << e.name;
+        out << ",polarization,mean_speed,neighbours,scanned_per_frame\n";
+    }
+
+    for (int m = 0; m < ens.members; m++) {
+        out << m << "," << ens.seeds[m] << "," << ens.N << "," << frames;
+        for (float v : ens.values[m])
+            out << "," << v;
+        out << "," << results[m].polarization
+            << "," << results[m].mean_speed
+            << "," << results[m].neighbours
+            << "," << results[m].scanned << "\n";
+    }
+}
+
+/**
+ * Whole run of an ensemble, headless. --snapshot writes one snapshot per member (<path>.m<k>), with
+ * the parameters of the member in the header.
+ **/
+template<class Layout, class Exec>
+inline int run_ensemble(Config cfg) {
+    using ExecM = WithParams<Exec, MemberParams>;
+
+    if (cfg.neighbours != "all" && cfg.neighbours != "grid") {
+        std::cerr << "The ensemble supports --neighbours all or grid, not " << cfg.neighbours << std::endl;
+        exit(EXIT_FAILURE);
+    }
+    if (!cfg.restore.empty() || cfg.symmetric || cfg.block != 0 || cfg.reorder_every > 0 || cfg.storage != "fp32"
+        || cfg.drift || cfg.schedule != "static" || cfg.pipeline || !cfg.trajectory.empty() || !cfg.headless)
+        std::cerr << "Warning: the ensemble is headless and supports only --N --frames --threads --csv --neighbours "
+                     "--kernel --seed --affinity --params --param --sweep --snapshot --counters, the other options are ignored" << std::endl;
+
+    load_flock_params(cfg.params, cfg.param);
+    print_params();
+
+    omp_set_num_threads(cfg.threads);
+    std::cout << "Threads set: " << cfg.threads << "\n";
+    pin_threads(cfg.affinity);
+
+    Ensemble<Layout> ens = allocate_ensemble<Layout>(cfg);
+    const uint64_t seed = run_seed(cfg);
+    init_ensemble(ens, seed);
+
+    const std::string kernel = "ensemble" + std::to_string(ens.members) + "_" + ens.kernel.name;
+    std::cout << "Ensemble: " << ens.members << " flocks of " << ens.N << " boids"
+              << (cfg.sweep.empty() ? "" : ", sweep " + cfg.sweep) << "\n";
+    std::cout << "Seed: " << seed << " (member m: seed + m)\n";
+    std::cout << "Kernel: " << kernel << "\n";
+    report_placement<Layout>(ens.boids, ens.members * ens.stride, "the ensemble");
+
+    PerfCounters counters;
+    if (cfg.counters)
+        open_perf_counters(counters, cfg.threads);
+
+    int iterations = 0;
+    FrameStats stats = allocate_frame_stats(cfg.frames);
+
+    while (iterations < cfg.frames) {
+        const auto start = std::chrono::steady_clock::now();
+        enable_perf_counters(counters);
+        step_ensemble<Layout, ExecM>(ens);
+        disable_perf_counters(counters);
+        iterations++;
+        const auto end = std::chrono::steady_clock::now();
+        record_frame(stats, std::chrono::duration_cast<std::chrono::nanoseconds>(end - start).count());
+    }
+
+    if (!cfg.snapshot.empty()) {
+        const std::vector<float> base = param_values();
+        std::vector<int> slot_of(ens.N);
+        for (int m = 0; m < ens.members; m++) {
+            for (int i = 0; i < ens.N; i++)
+                slot_of[i] = m * ens.stride + i;
+            set_param_values(ens.values[m]); // recorded in the header
+            write_snapshot<Layout>(cfg.snapshot + ".m" + std::to_string(m), ens.boids, slot_of.data(), ens.N, iterations);
+        }
+        set_param_values(base);
+    }
+
+    const LatencySummary latency = summarize_frames(stats);
+    const CounterTotals counter_totals = close_perf_counters(counters);
+    const std::vector<MemberResult> results = ensemble_results(ens, iterations);
+
+    append_csv(cfg.csv, ens.N, cfg.frames, cfg.threads, kernel, latency, 0, counter_totals);
+    append_latency_json(cfg.csv, ens.N, cfg.frames, cfg.threads, kernel, latency);
+    append_members_csv(cfg.csv, ens, iterations, results);
+
+    printf("Frame %d duration: %.3f milliseconds\n", iterations, latency.total_ns / 1e6);
+    print_latency(latency, iterations);
+    print_perf_counters(counter_totals, iterations, (long long)ens.members * ens.N);
+    for (int m = 0; m < ens.members; m++)
+        printf("Member %d: seed %llu, polarization %.3f, mean speed %.3f, %.1f neighbours per boid\n",
+               m, (unsigned long long)ens.seeds[m], results[m].polarization, results[m].mean_speed, results[m].neighbours);
+
+    free_ensemble(ens);
+
+    return 0;
+}
@@ -0,0 +1,258 @@
+//
+// Created by giacomo on 24/02/26.
+//
+
+#pragma once //to include the file only once
+
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+/**
+ * Parameters of the model, in two forms with the same names:
+ *  - Params: the production set, static constexpr, so the kernels are compiled with the constants
+ *    folded in (squared ranges as immediates, no loads in the neighbour loop);
+ *  - RuntimeParams: the same fields as static variables, set from --params <file> and --param NAME=value
+ *    (file lines "NAME = value", # comments), for parameter studies without a rebuild;
+ *  - MemberParams: the same fields again as plain members, one object per flock of an ensemble.
+ * The engine reads them through the execution policy (Exec::Parameters): the plain policies use
+ * Params, WithParams<Exec, RuntimeParams> the runtime values. run_simulation() takes the compiled
+ * instantiation whenever the values given are the ones of Params, so only a run that really changes
+ * a parameter pays for the generic one. Another fixed set is one more struct like Params and one more
+ * check in the dispatch.
+ **/
+
+// Constants definition
+struct Params {
+    static constexpr float TURN_FACTOR = 0.2f;
+    static constexpr float VISUAL_RANGE = 40.0f;
+    static constexpr float PROTECTED_RANGE = 8.0f;
+    static constexpr float CENTERING_FACTOR = 0.0005f;
+    static constexpr float AVOID_FACTOR = 0.05f;
+    static constexpr float MATCHING_FACTOR = 0.05f;
+    static constexpr float MAX_SPEED = 6.0f;
+    static constexpr float MIN_SPEED = 3.0f;
+    static constexpr int TOP_MARGIN = 600;
+    static constexpr float BOT_MARGIN = 0;
+    static constexpr float LEFT_MARGIN = 0;
+    static constexpr int RIGHT_MARGIN = 800;
+    static constexpr float MARGIN = 80.0f;
+    static constexpr float FRONT_MARGIN = 0;  // third axis of the 3D flocks, as deep as the window is tall
+    static constexpr int BACK_MARGIN = 600;
+
+    static constexpr float SQ_PROTECTED_RANGE = PROTECTED_RANGE * PROTECTED_RANGE;
+    static constexpr float SQ_VISUAL_RANGE = VISUAL_RANGE * VISUAL_RANGE;
+
+    // Graphical window size, and depth of the space in 3D
+    static constexpr int X_SIZE = RIGHT_MARGIN + (int)MARGIN;
+    static constexpr int Y_SIZE = TOP_MARGIN + (int)MARGIN;
+    static constexpr int Z_SIZE = BACK_MARGIN + (int)MARGIN;
+};
+
+// Values of the run, the ones of Params unless changed by load_flock_params()
+struct RuntimeParams {
+    static inline float TURN_FACTOR = Params::TURN_FACTOR;
+    static inline float VISUAL_RANGE = Params::VISUAL_RANGE;
+    static inline float PROTECTED_RANGE = Params::PROTECTED_RANGE;
+    static inline float CENTERING_FACTOR = Params::CENTERING_FACTOR;
+    static inline float AVOID_FACTOR = Params::AVOID_FACTOR;
+    static inline float MATCHING_FACTOR = Params::MATCHING_FACTOR;
+    static inline float MAX_SPEED = Params::MAX_SPEED;
+    static inline float MIN_SPEED = Params::MIN_SPEED;
+    static inline int TOP_MARGIN = Params::TOP_MARGIN;
+    static inline float BOT_MARGIN = Params::BOT_MARGIN;
+    static inline float LEFT_MARGIN = Params::LEFT_MARGIN;
+    static inline int RIGHT_MARGIN = Params::RIGHT_MARGIN;
+    static inline float MARGIN = Params::MARGIN;
+    static inline float FRONT_MARGIN = Params::FRONT_MARGIN;
+    static inline int BACK_MARGIN = Params::BACK_MARGIN;
+
+    static inline float SQ_PROTECTED_RANGE = Params::SQ_PROTECTED_RANGE;
+    static inline float SQ_VISUAL_RANGE = Params::SQ_VISUAL_RANGE;
+    static inline int X_SIZE = Params::X_SIZE;
+    static inline int Y_SIZE = Params::Y_SIZE;
+    static inline int Z_SIZE = Params::Z_SIZE;
+};
+
+/**
+ * The same fields as ordinary members: one set per flock of an ensemble (see Ensemble.h), passed to
+ * the engine as an object. The default is a copy of RuntimeParams when it is made.
+ **/
+struct MemberParams {
+    float TURN_FACTOR = RuntimeParams::TURN_FACTOR;
+    float VISUAL_RANGE = RuntimeParams::VISUAL_RANGE;
+    float PROTECTED_RANGE = RuntimeParams::PROTECTED_RANGE;
+    float CENTERING_FACTOR = RuntimeParams::CENTERING_FACTOR;
+    float AVOID_FACTOR = RuntimeParams::AVOID_FACTOR;
+    float MATCHING_FACTOR = RuntimeParams::MATCHING_FACTOR;
+    float MAX_SPEED = RuntimeParams::MAX_SPEED;
+    float MIN_SPEED = RuntimeParams::MIN_SPEED;
+    int TOP_MARGIN = RuntimeParams::TOP_MARGIN;
+    float BOT_MARGIN = RuntimeParams::BOT_MARGIN;
+    float LEFT_MARGIN = RuntimeParams::LEFT_MARGIN;
+    int RIGHT_MARGIN = RuntimeParams::RIGHT_MARGIN;
+    float MARGIN = RuntimeParams::MARGIN;
+    float FRONT_MARGIN = RuntimeParams::FRONT_MARGIN;
+    int BACK_MARGIN = RuntimeParams::BACK_MARGIN;
+
+    float SQ_PROTECTED_RANGE = RuntimeParams::SQ_PROTECTED_RANGE;
+    float SQ_VISUAL_RANGE = RuntimeParams::SQ_VISUAL_RANGE;
+    int X_SIZE = RuntimeParams::X_SIZE;
+    int Y_SIZE = RuntimeParams::Y_SIZE;
+    int Z_SIZE = RuntimeParams::Z_SIZE;
+};
+
+// Exits if the values of RuntimeParams can't be used by the model
+inline void validate_params() {
+    using R = RuntimeParams;
+    if (R::VISUAL_RANGE <= 0.0f || R::PROTECTED_RANGE < 0.0f || R::PROTECTED_RANGE > R::VISUAL_RANGE
+        || R::MIN_SPEED < 0.0f || R::MAX_SPEED < R::MIN_SPEED || R::MARGIN < 0.0f
+        || R::LEFT_MARGIN + 2 * R::MARGIN > R::RIGHT_MARGIN || R::BOT_MARGIN + 2 * R::MARGIN > R::TOP_MARGIN
+        || R::FRONT_MARGIN + 2 * R::MARGIN > R::BACK_MARGIN) {
+        std::cerr << "Invalid parameters: ranges and speeds must be ordered, the margins must leave room inside the window" << std::endl;
+        exit(EXIT_FAILURE);
+    }
+}
+
+// Squared ranges and window size from the values of RuntimeParams
+inline void update_derived_params() {
+    using R = RuntimeParams;
+    R::SQ_PROTECTED_RANGE = R::PROTECTED_RANGE * R::PROTECTED_RANGE;
+    R::SQ_VISUAL_RANGE = R::VISUAL_RANGE * R::VISUAL_RANGE;
+    R::X_SIZE = R::RIGHT_MARGIN + (int)R::MARGIN;
+    R::Y_SIZE = R::TOP_MARGIN + (int)R::MARGIN;
+    R::Z_SIZE = R::BACK_MARGIN + (int)R::MARGIN;
+}
+
+struct ParamEntry {
+    const char* name;
+    float* value;     // float parameters
+    int* int_value;   // integer ones (the margins kept as int by Params)
+    float compiled;   // value in Params
+};
+
+inline std::vector<ParamEntry> param_entries() {
+    using R = RuntimeParams;
+    return {
+        {"TURN_FACTOR", &R::TURN_FACTOR, nullptr, Params::TURN_FACTOR},
+        {"VISUAL_RANGE", &R::VISUAL_RANGE, nullptr, Params::VISUAL_RANGE},
+        {"PROTECTED_RANGE", &R::PROTECTED_RANGE, nullptr, Params::PROTECTED_RANGE},
+        {"CENTERING_FACTOR", &R::CENTERING_FACTOR, nullptr, Params::CENTERING_FACTOR},
+        {"AVOID_FACTOR", &R::AVOID_FACTOR, nullptr, Params::AVOID_FACTOR},
+        {"MATCHING_FACTOR", &R::MATCHING_FACTOR, nullptr, Params::MATCHING_FACTOR},
+        {"MAX_SPEED", &R::MAX_SPEED, nullptr, Params::MAX_SPEED},
+        {"MIN_SPEED", &R::MIN_SPEED, nullptr, Params::MIN_SPEED},
+        {"TOP_MARGIN", nullptr, &R::TOP_MARGIN, (float)Params::TOP_MARGIN},
+        {"BOT_MARGIN", &R::BOT_MARGIN, nullptr, Params::BOT_MARGIN},
+        {"LEFT_MARGIN", &R::LEFT_MARGIN, nullptr, Params::LEFT_MARGIN},
+        {"RIGHT_MARGIN", nullptr, &R::RIGHT_MARGIN, (float)Params::RIGHT_MARGIN},
+        {"MARGIN", &R::MARGIN, nullptr, Params::MARGIN},
+        {"FRONT_MARGIN", &R::FRONT_MARGIN, nullptr, Params::FRONT_MARGIN},
+        {"BACK_MARGIN", nullptr, &R::BACK_MARGIN, (float)Params::BACK_MARGIN},
+    };
+}
+
+inline float param_value(const ParamEntry& e) {
+    return e.value ? *e.value : (float)*e.int_value;
+}
+
+// All the values in the order of param_entries(), to save and restore RuntimeParams
+inline std::vector<float> param_values() {
+    std::vector<float> values;
+    for (const ParamEntry& e : param_entries())
+        values.push_back(param_value(e));
+    return values;
+}
+
+inline void set_param_values(const std::vector<float>& values) {
+    const std::vector<ParamEntry> entries = param_entries();
+    for (size_t k = 0; k < entries.size(); k++) {
+        if (entries[k].value)
+            *entries[k].value = values[k];
+        else
+            *entries[k].int_value = (int)values[k];
+    }
+    update_derived_params();
+}
+
+inline void set_param(const std::string& name, const std::string& text) {
+    for (const ParamEntry& e : param_entries()) {
+        if (name != e.name)
+            continue;
+
+        try {
+            if (e.value)
+                *e.value = std::stof(text);
+            else
+                *e.int_value = std::stoi(text);
+        } catch (const std::exception&) {
+            std::cerr << "Invalid value for " << name << ": " << text << std::endl;
+            exit(EXIT_FAILURE);
+        }
+        return;
+    }
+
+    std::cerr << "Unknown parameter: " << name << std::endl;
+    exit(EXIT_FAILURE);
+}
+
+// "NAME=value" or "NAME = value", spaces allowed around the name and the value
+inline void set_param_assignment(const std::string& assignment) {
+    const size_t eq = assignment.find('=');
+    if (eq == std::string::npos) {
+        std::cerr << "Expected NAME=value: " << assignment << std::endl;
+        exit(EXIT_FAILURE);
+    }
+
+    auto trim = [](std::string s) {
+        s.erase(0, s.find_first_not_of(" \t\r"));
+        s.erase(s.find_last_not_of(" \t\r") + 1);
+        return s;
+    };
+    set_param(trim(assignment.substr(0, eq)), trim(assignment.substr(eq + 1)));
+}
+
+/**
+ * Sets RuntimeParams from the file (if any) and then from the single assignments, so the command line
+ * wins over the file. Exits on unknown names and on values the model can't use.
+ **/
+inline void load_flock_params(const std::string& file, const std::vector<std::string>& assignments) {
+    if (!file.empty()) {
+        std::ifstream in(file);
+        if (!in) {
+            std::cerr << "Cannot read parameters " << file << std::endl;
+            exit(EXIT_FAILURE);
+        }
+
+        std::string line;
+        while (std::getline(in, line)) {
+            line = line.substr(0, line.find('#'));
+            if (line.find_first_not_of(" \t\r") != std::string::npos)
+                set_param_assignment(line);
+        }
+    }
+    for (const std::string& assignment : assignments)
+        set_param_assignment(assignment);
+
+    validate_params();
+    update_derived_params();
+}
+
+// True when the run can use the compiled Params
+inline bool params_are_compiled() {
+    for (const ParamEntry& e : param_entries()) {
+        if (param_value(e) != e.compiled)
+            return false;
+    }
+    return true;
+}
+
+inline void print_params() {
+    std::cout << "Parameters (" << (params_are_compiled() ? "compiled" : "runtime") << "):";
+    for (const ParamEntry& e : param_entries())
+        std::cout << " " << e.name << "=" << param_value(e);
+    std::cout << "\n";
+}
@@ -0,0 +1,196 @@
+//
+// Created by giacomo on 09/02/26.
+//
+
+#pragma once //to include the file only once
+
+#include "Perf_counters.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <fstream>
+#include <string>
+#include <vector>
+
+/**
+ * Per-frame latencies in nanoseconds. The buffer is allocated once before the frame loop, so
+ * recording a frame is only a store. At the end of the run the distribution is summarized with
+ * min/p50/p90/p99/max and a histogram with power of two buckets (the tail is what matters for a
+ * frame deadline, a single total in milliseconds hides it and rounds sub-millisecond frames to 0).
+ **/
+
+constexpr int HISTOGRAM_BUCKETS = 40; // bucket b holds the frames in [2^b, 2^(b+1)) ns, 2^40 ns ~ 18 min
+
+struct FrameStats {
+    std::vector<long long> frame_ns;
+    int recorded = 0;
+};
+
+struct LatencySummary {
+    long long total_ns = 0;
+    long long min_ns = 0, p50_ns = 0, p90_ns = 0, p99_ns = 0, max_ns = 0;
+    double mean_ns = 0.0;
+    long long histogram[HISTOGRAM_BUCKETS] = {};
+};
+
+inline FrameStats allocate_frame_stats(int frames) {
+    FrameStats stats;
+    stats.frame_ns.resize(std::max(frames, 0));
+    return stats;
+}
+
+inline void record_frame(FrameStats& stats, long long ns) {
+    if (stats.recorded < (int)stats.frame_ns.size())
+        stats.frame_ns[stats.recorded++] = ns;
+}
+
+inline int histogram_bucket(long long ns) {
+    int bucket = 0;
+    while (ns > 1 && bucket < HISTOGRAM_BUCKETS - 1) {
+        ns >>= 1;
+        bucket++;
+    }
+    return bucket;
+}
+
+// Nearest-rank percentiles on a sorted copy, done once at the end of the run
+inline LatencySummary summarize_frames(const FrameStats& stats) {
+    LatencySummary summary;
+    if (stats.recorded == 0)
+        return summary;
+
+    std::vector<long long> sorted(stats.frame_ns.begin(), stats.frame_ns.begin() + stats.recorded);
+    std::sort(sorted.begin(), sorted.end());
+
+    auto percentile = [&sorted](double p) {
+        size_t rank = (size_t)std::ceil(p / 100.0 * sorted.size());
+        return sorted[std::min(std::max(rank, (size_t)1), sorted.size()) - 1];
+    };
+
+    for (long long ns : sorted) {
+        summary.total_ns += ns;
+        summary.histogram[histogram_bucket(ns)]++;
+    }
+
+    summary.min_ns = sorted.front();
+    summary.p50_ns = percentile(50);
+    summary.p90_ns = percentile(90);
+    summary.p99_ns = percentile(99);
+    summary.max_ns = sorted.back();
+    summary.mean_ns = (double)summary.total_ns / sorted.size();
+
+    return summary;
+}
+
+inline void print_latency(const LatencySummary& s, int frames) {
+    printf("Frame latency over %d frames (us): min %.1f, p50 %.1f, p90 %.1f, p99 %.1f, max %.1f, mean %.1f\n",
+           frames, s.min_ns / 1e3, s.p50_ns / 1e3, s.p90_ns / 1e3, s.p99_ns / 1e3, s.max_ns / 1e3, s.mean_ns / 1e3);
+
+    long long peak = 1;
+    for (long long count : s.histogram)
+        peak = std::max(peak, count);
+
+    for (int b = 0; b < HISTOGRAM_BUCKETS; b++) {
+        if (s.histogram[b] == 0)
+            continue;
+        const int bar = (int)(50 * s.histogram[b] / peak);
+        printf("  [%10.1f, %10.1f) us %8lld %s\n",
+               (double)(1LL << b) / 1e3, (double)(1LL << (b + 1)) / 1e3, s.histogram[b],
+               std::string(std::max(bar, 1), '#').c_str());
+    }
+}
+
+// time_ms is the sum of the frames measured in nanoseconds, the latency columns are in microseconds.
+// The hardware counters (see Perf_counters.h) are run totals, empty without --counters.
+inline void append_csv(const std::string& filename,
+                       int N, int frames, int threads,
+                       const std::string& kernel, const LatencySummary& latency, int block,
+                       const CounterTotals& counters = CounterTotals{})
+{
+    static bool first = true;
+    std::ofstream out(filename, std::ios::app);
+
+    if (first) {
+        out << "N,frames,threads,time_ms,kernel,min_us,p50_us,p90_us,p99_us,max_us,block";
+        for (const char* name : PERF_COUNTER_NAMES)
+            out << "," << name;
+        out << "\n";
+        first = false;
+    }
+
+    out << N << ","
+        << frames << ","
+        << threads << ","
+        << latency.total_ns / 1e6 << ","
+        << kernel << ","
+        << latency.min_ns / 1e3 << ","
+        << latency.p50_ns / 1e3 << ","
+        << latency.p90_ns / 1e3 << ","
+        << latency.p99_ns / 1e3 << ","
+        << latency.max_ns / 1e3 << ","
+        << block;
+    for (int k = 0; k < PERF_COUNTERS; k++) {
+        out << ",";
+        if (counters.valid[k])
+            out << (long long)counters.value[k];
+    }
+    out << "\n";
+}
+
+/**
+ * Time spent by every thread in the frame loop, without the waits at the final barrier. The imbalance
+ * is max/mean over all the threads, the idle ones included: 1 means that no thread waited for the others.
+ **/
+inline void print_busy(const std::vector<long long>& busy_ns) {
+    long long total = 0, peak = 0;
+    for (long long ns : busy_ns) {
+        total += ns;
+        peak = std::max(peak, ns);
+    }
+    if (total == 0)
+        return;
+
+    printf("Thread busy time (ms):");
+    for (long long ns : busy_ns)
+        printf(" %.2f", ns / 1e6);
+    printf(", imbalance max/mean %.3f\n", (double)peak * busy_ns.size() / total);
+}
+
+/**
+ * JSON sidecar of the csv: one object per run (JSON lines) with the percentiles and the histogram,
+ * written in <csv>.latency.jsonl.
+ **/
+inline void append_latency_json(const std::string& csv_filename,
+                                int N, int frames, int threads, const std::string& kernel,
+                                const LatencySummary& s)
+{
+    if (csv_filename.empty())
+        return;
+
+    std::ofstream out(csv_filename + ".latency.jsonl", std::ios::app);
+
+    out << "{\"N\":" << N
+        << ",\"frames\":" << frames
+        << ",\"threads\":" << threads
+        << ",\"kernel\":\"" << kernel << "\""
+        << ",\"total_ns\":" << s.total_ns
+        << ",\"min_ns\":" << s.min_ns
+        << ",\"p50_ns\":" << s.p50_ns
+        << ",\"p90_ns\":" << s.p90_ns
+        << ",\"p99_ns\":" << s.p99_ns
+        << ",\"max_ns\":" << s.max_ns
+        << ",\"mean_ns\":" << s.mean_ns
+        << ",\"histogram\":[";
+
+    // Only the non-empty buckets, as [lower bound in ns, frames]
+    bool first = true;
+    for (int b = 0; b < HISTOGRAM_BUCKETS; b++) {
+        if (s.histogram[b] == 0)
+            continue;
+        out << (first ? "" : ",") << "[" << (1LL << b) << "," << s.histogram[b] << "]";
+        first = false;
+    }
+
+    out << "]}\n";
+}
@@ -0,0 +1,170 @@
+//
+// Created by giacomo on 02/02/26.
+//
+
+#pragma once //to include the file only once
+
+#include <algorithm>
+#include <cmath>
+#include <omp.h>
+
+/**
+ * Uniform grid used to avoid the O(N^2) comparison.
+ * Cells are VISUAL_RANGE wide, so two boids that can see each other are always in the same cell
+ * or in adjacent ones and it is enough to scan the 3x3 block around the cell of a boid.
+ * Every frame the boids are binned with a parallel counting sort into a copy ordered by cell
+ * (same layout of the simulation): cells of the same row are contiguous, so the 3 cells of a row
+ * of the block are a single contiguous range of the arrays and the SIMD loop can run on it.
+ * In 3D (Layout::D == 3) the grid has layers along z, stacked after each other, and the block
+ * around a cell is 3x3x3: still 3 cells per row, so 9 ranges instead of 3. In 2D there is one layer.
+ **/
+
+template<class Layout>
+struct Grid {
+    int cols, rows, layers;
+    float cell_size;
+    int n_threads;
+
+    int* cell_start;    // cols*rows*layers + 1 entries, first binned index of every cell
+    int* thread_offset; // n_threads * cells entries, per-thread histograms and then offsets
+    int* cell_of;       // cell of every boid (original index)
+    int* order;         // binned index -> original index
+
+    typename Layout::Storage binned; // copy of the boids sorted by cell
+};
+
+// z and vz of boid i for the code shared by 2D and 3D, 0 in 2D (the 2D layouts have no z)
+template<class Layout>
+inline float layout_z(const typename Layout::Storage& b, int i) {
+    if constexpr (Layout::D == 3)
+        return Layout::z(b, i);
+    return 0.0f;
+}
+
+template<class Layout>
+inline float layout_vz(const typename Layout::Storage& b, int i) {
+    if constexpr (Layout::D == 3)
+        return Layout::vz(b, i);
+    return 0.0f;
+}
+
+// Stores a boid in the layout, z and vz are dropped in 2D
+template<class Layout>
+inline void store_boid(typename Layout::Storage& b, int i, float x, float y, float z, float vx, float vy, float vz) {
+    if constexpr (Layout::D == 3)
+        Layout::store(b, i, x, y, z, vx, vy, vz);
+    else
+        Layout::store(b, i, x, y, vx, vy);
+}
+
+// Boids outside the window are clamped into the border cells, this keeps neighbours
+// at most one cell apart. z is only read in 3D.
+template<class Layout>
+inline int grid_cell(const Grid<Layout>& grid, float x, float y, float z = 0.0f) {
+    const float fx = std::clamp(x / grid.cell_size, 0.0f, (float)(grid.cols - 1));
+    const float fy = std::clamp(y / grid.cell_size, 0.0f, (float)(grid.rows - 1));
+    if constexpr (Layout::D == 3) {
+        const float fz = std::clamp(z / grid.cell_size, 0.0f, (float)(grid.layers - 1));
+        return ((int)fz * grid.rows + (int)fy) * grid.cols + (int)fx;
+    }
+    (void)z;
+    return (int)fy * grid.cols + (int)fx;
+}
+
+/**
+ * Calls range(first, last) for every contiguous range of binned boids of the 3x3 (3x3x3 in 3D)
+ * block around a cell: one per row of the block, columns from the left to the right neighbour.
+ **/
+template<class Layout, class Range>
+inline void for_each_block_range(const Grid<Layout>& grid, int cell, Range&& range) {
+    const int cx = cell % grid.cols;
+    const int cy = cell / grid.cols % grid.rows;
+    const int col_first = std::max(cx - 1, 0);
+    const int col_last = std::min(cx + 1, grid.cols - 1);
+    int layer_first = 0, layer_last = 0;
+    if constexpr (Layout::D == 3) {
+        const int cz = cell / (grid.cols * grid.rows);
+        layer_first = std::max(cz - 1, 0);
+        layer_last = std::min(cz + 1, grid.layers - 1);
+    }
+
+    for (int layer = layer_first; layer <= layer_last; layer++) {
+        for (int row = std::max(cy - 1, 0); row <= std::min(cy + 1, grid.rows - 1); row++) {
+            const int run = (layer * grid.rows + row) * grid.cols;
+            range(grid.cell_start[run + col_first], grid.cell_start[run + col_last + 1]);
+        }
+    }
+}
+
+// depth is the extent along z, only used in 3D
+template<class Layout>
+inline Grid<Layout> allocate_grid(int N, int width, int height, int depth, float cell_size, int n_threads) {
+    Grid<Layout> grid;
+    grid.cell_size = cell_size;
+    grid.cols = std::max(1, (int)std::ceil(width / cell_size));
+    grid.rows = std::max(1, (int)std::ceil(height / cell_size));
+    grid.layers = Layout::D == 3 ? std::max(1, (int)std::ceil(depth / cell_size)) : 1;
+    grid.n_threads = n_threads;
+
+    const int cells = grid.cols * grid.rows * grid.layers;
+    grid.cell_start = new int[cells + 1];
+    grid.thread_offset = new int[(size_t)n_threads * cells];
+    grid.cell_of = new int[N];
+    grid.order = new int[N];
+    grid.binned = Layout::allocate(N);
+
+    return grid;
+}
+
+template<class Layout>
+inline void free_grid(Grid<Layout>& grid) {
+    delete [] grid.cell_start;
+    delete [] grid.thread_offset;
+    delete [] grid.cell_of;
+    delete [] grid.order;
+    Layout::release(grid.binned);
+}
+
+/**
+ * Parallel counting sort of the boids by cell. It must be called from inside a parallel region:
+ * both loops use schedule(static) on the same range, so every thread scatters exactly the boids
+ * it has counted and the sort is stable.
+ **/
+template<class Layout>
+inline void build_grid(Grid<Layout>& grid, const typename Layout::Storage& boids, int N) {
+    const int cells = grid.cols * grid.rows * grid.layers;
+    const int tid = omp_get_thread_num();
+    int* offset = grid.thread_offset + (size_t)tid * cells;
+
+    std::fill(offset, offset + cells, 0);
+
+#pragma omp for schedule(static)
+    for (int i = 0; i < N; i++) {
+        const int c = grid_cell(grid, Layout::x(boids, i), Layout::y(boids, i), layout_z<Layout>(boids, i));
+        grid.cell_of[i] = c;
+        offset[c]++;
+    }
+
+    // Exclusive scan cell by cell, inside a cell thread by thread (cells are few, it's cheap)
+#pragma omp single
+    {
+        const int n_threads = omp_get_num_threads();
+        int running = 0;
+        for (int c = 0; c < cells; c++) {
+            grid.cell_start[c] = running;
+            for (int t = 0; t < n_threads; t++) {
+                int count = grid.thread_offset[(size_t)t * cells + c];
+                grid.thread_offset[(size_t)t * cells + c] = running;
+                running += count;
+            }
+        }
+        grid.cell_start[cells] = running;
+    }
+
+#pragma omp for schedule(static)
+    for (int i = 0; i < N; i++) {
+        const int pos = offset[grid.cell_of[i]]++;
+        grid.order[pos] = i;
+        Layout::copy(grid.binned, pos, boids, i);
+    }
+}
@@ -0,0 +1,425 @@
+//
+// Created by giacomo on 05/02/26.
+//
+
+#pragma once //to include the file only once
+
+#include <cstdlib>
+#include <iostream>
+#include <string>
+#include <utility>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define BOIDS_X86 1
+#endif
+
+/**
+ * Hand-written neighbour kernels for the layouts with one contiguous array per field (SOA).
+ * They are compiled with per-function target attributes, so the binary doesn't need -mavx2 or
+ * -march=native: the best kernel supported by the CPU is chosen at startup from CPUID and its name
+ * is written in the csv, to keep results comparable between different machines.
+ * All of them compute exactly the branchless loop of the OpenMP SIMD version: a boid is protected
+ * if dist_sq < sq_protected and aligns if it is visible but not protected.
+ * They are templates on the number of dimensions D: in 3D the z terms are added at compile time,
+ * in 2D the z arguments are never read.
+ **/
+
+// Sums over the neighbours of a boid
+struct Neighbourhood {
+    float x_avg = 0.0f;
+    float y_avg = 0.0f;
+    float xv_avg = 0.0f;
+    float yv_avg = 0.0f;
+    float n_neighbours = 0.0f;
+    float close_dx = 0.0f;
+    float close_dy = 0.0f;
+    float z_avg = 0.0f;   // only in 3D
+    float zv_avg = 0.0f;
+    float close_dz = 0.0f;
+};
+
+// Accumulates on acc the boids in [first, last) seen by the boid in (xi, yi, zi)
+using NeighbourKernel = void (*)(const float* x, const float* y, const float* z,
+                                 const float* vx, const float* vy, const float* vz,
+                                 int first, int last, float xi, float yi, float zi,
+                                 float sq_protected, float sq_visual, Neighbourhood& acc);
+
+struct KernelInfo {
+    const char* name;
+    NeighbourKernel fn; // nullptr means the compiler vectorized loop (#pragma omp simd)
+};
+
+// Scalar branchless body, used for the tails of the vector kernels
+template<int D>
+inline void neighbours_tail(const float* x, const float* y, const float* z,
+                            const float* vx, const float* vy, const float* vz,
+                            int first, int last, float xi, float yi, float zi,
+                            float sq_protected, float sq_visual, Neighbourhood& acc) {
+    for (int j = first; j < last; j++) {
+        float dx = xi - x[j];
+        float dy = yi - y[j];
+        float dist_sq = dx*dx + dy*dy;
+        float dz = 0.0f;
+        if constexpr (D == 3) {
+            dz = zi - z[j];
+            dist_sq += dz*dz;
+        }
+
+        float is_protected = (dist_sq < sq_protected) ? 1.0f : 0.0f;
+        float is_alignment = ((dist_sq < sq_visual) ? 1.0f : 0.0f) - is_protected;
+
+        acc.close_dx += dx * is_protected;
+        acc.close_dy += dy * is_protected;
+        acc.xv_avg += vx[j] * is_alignment;
+        acc.yv_avg += vy[j] * is_alignment;
+        acc.x_avg  += x[j]  * is_alignment;
+        acc.y_avg  += y[j]  * is_alignment;
+        acc.n_neighbours += is_alignment;
+        if constexpr (D == 3) {
+            acc.close_dz += dz * is_protected;
+            acc.zv_avg += vz[j] * is_alignment;
+            acc.z_avg  += z[j]  * is_alignment;
+        }
+    }
+}
+
+#ifdef BOIDS_X86
+
+__attribute__((target("sse4.2")))
+inline float hsum_sse(__m128 v) {
+    __m128 shuf = _mm_movehdup_ps(v);
+    __m128 sums = _mm_add_ps(v, shuf);
+    shuf = _mm_movehl_ps(shuf, sums);
+    return _mm_cvtss_f32(_mm_add_ss(sums, shuf));
+}
+
+// 4 boids per iteration
+template<int D>
+__attribute__((target("sse4.2")))
+inline void neighbours_sse42(const float* x, const float* y, const float* z,
+                             const float* vx, const float* vy, const float* vz,
+                             int first, int last, float xi, float yi, float zi,
+                             float sq_protected, float sq_visual, Neighbourhood& acc) {
+    const __m128 XI = _mm_set1_ps(xi);
+    const __m128 YI = _mm_set1_ps(yi);
+    const __m128 ZI = _mm_set1_ps(zi);
+    const __m128 SQ_P = _mm_set1_ps(sq_protected);
+    const __m128 SQ_V = _mm_set1_ps(sq_visual);
+    const __m128 ONE = _mm_set1_ps(1.0f);
+
+    __m128 close_dx = _mm_setzero_ps(), close_dy = _mm_setzero_ps();
+    __m128 x_avg = _mm_setzero_ps(), y_avg = _mm_setzero_ps();
+    __m128 xv_avg = _mm_setzero_ps(), yv_avg = _mm_setzero_ps();
+    __m128 close_dz = _mm_setzero_ps(), z_avg = _mm_setzero_ps(), zv_avg = _mm_setzero_ps();
+    __m128 n = _mm_setzero_ps();
+
+    int j = first;
+    for (; j + 4 <= last; j += 4) {
+        const __m128 X = _mm_loadu_ps(x + j);
+        const __m128 Y = _mm_loadu_ps(y + j);
+        const __m128 dx = _mm_sub_ps(XI, X);
+        const __m128 dy = _mm_sub_ps(YI, Y);
+        __m128 dist_sq = _mm_add_ps(_mm_mul_ps(dx, dx), _mm_mul_ps(dy, dy));
+        __m128 Z, dz;
+        if constexpr (D == 3) {
+            Z = _mm_loadu_ps(z + j);
+            dz = _mm_sub_ps(ZI, Z);
+            dist_sq = _mm_add_ps(dist_sq, _mm_mul_ps(dz, dz));
+        }
+
+        const __m128 is_protected = _mm_cmplt_ps(dist_sq, SQ_P);
+        // visible BUT NOT protected
+        const __m128 is_alignment = _mm_andnot_ps(is_protected, _mm_cmplt_ps(dist_sq, SQ_V));
+
+        close_dx = _mm_add_ps(close_dx, _mm_and_ps(is_protected, dx));
+        close_dy = _mm_add_ps(close_dy, _mm_and_ps(is_protected, dy));
+        xv_avg = _mm_add_ps(xv_avg, _mm_and_ps(is_alignment, _mm_loadu_ps(vx + j)));
+        yv_avg = _mm_add_ps(yv_avg, _mm_and_ps(is_alignment, _mm_loadu_ps(vy + j)));
+        x_avg = _mm_add_ps(x_avg, _mm_and_ps(is_alignment, X));
+        y_avg = _mm_add_ps(y_avg, _mm_and_ps(is_alignment, Y));
+        n = _mm_add_ps(n, _mm_and_ps(is_alignment, ONE));
+        if constexpr (D == 3) {
+            close_dz = _mm_add_ps(close_dz, _mm_and_ps(is_protected, dz));
+            zv_avg = _mm_add_ps(zv_avg, _mm_and_ps(is_alignment, _mm_loadu_ps(vz + j)));
+            z_avg = _mm_add_ps(z_avg, _mm_and_ps(is_alignment, Z));
+        }
+    }
+
+    acc.close_dx += hsum_sse(close_dx);
+    acc.close_dy += hsum_sse(close_dy);
+    acc.xv_avg += hsum_sse(xv_avg);
+    acc.yv_avg += hsum_sse(yv_avg);
+    acc.x_avg += hsum_sse(x_avg);
+    acc.y_avg += hsum_sse(y_avg);
+    acc.n_neighbours += hsum_sse(n);
+    if constexpr (D == 3) {
+        acc.close_dz += hsum_sse(close_dz);
+        acc.zv_avg += hsum_sse(zv_avg);
+        acc.z_avg += hsum_sse(z_avg);
+    }
+
+    neighbours_tail<D>(x, y, z, vx, vy, vz, j, last, xi, yi, zi, sq_protected, sq_visual, acc);
+}
+
+__attribute__((target("avx2,fma")))
+inline float hsum_avx(__m256 v) {
+    __m128 lo = _mm256_castps256_ps128(v);
+    __m128 hi = _mm256_extractf128_ps(v, 1);
+    lo = _mm_add_ps(lo, hi);
+    __m128 shuf = _mm_movehdup_ps(lo);
+    __m128 sums = _mm_add_ps(lo, shuf);
+    shuf = _mm_movehl_ps(shuf, sums);
+    return _mm_cvtss_f32(_mm_add_ss(sums, shuf));
+}
+
+// 8 boids per iteration, the squared distance with an FMA
+template<int D>
+__attribute__((target("avx2,fma")))
+inline void neighbours_avx2(const float* x, const float* y, const float* z,
+                            const float* vx, const float* vy, const float* vz,
+                            int first, int last, float xi, float yi, float zi,
+                            float sq_protected, float sq_visual, Neighbourhood& acc) {
+    const __m256 XI = _mm256_set1_ps(xi);
+    const __m256 YI = _mm256_set1_ps(yi);
+    const __m256 ZI = _mm256_set1_ps(zi);
+    const __m256 SQ_P = _mm256_set1_ps(sq_protected);
+    const __m256 SQ_V = _mm256_set1_ps(sq_visual);
+    const __m256 ONE = _mm256_set1_ps(1.0f);
+
+    __m256 close_dx = _mm256_setzero_ps(), close_dy = _mm256_setzero_ps();
+    __m256 x_avg = _mm256_setzero_ps(), y_avg = _mm256_setzero_ps();
+    __m256 xv_avg = _mm256_setzero_ps(), yv_avg = _mm256_setzero_ps();
+    __m256 close_dz = _mm256_setzero_ps(), z_avg = _mm256_setzero_ps(), zv_avg = _mm256_setzero_ps();
+    __m256 n = _mm256_setzero_ps();
+
+    int j = first;
+    for (; j + 8 <= last; j += 8) {
+        const __m256 X = _mm256_loadu_ps(x + j);
+        const __m256 Y = _mm256_loadu_ps(y + j);
+        const __m256 dx = _mm256_sub_ps(XI, X);
+        const __m256 dy = _mm256_sub_ps(YI, Y);
+        __m256 dist_sq = _mm256_fmadd_ps(dx, dx, _mm256_mul_ps(dy, dy));
+        __m256 Z, dz;
+        if constexpr (D == 3) {
+            Z = _mm256_loadu_ps(z + j);
+            dz = _mm256_sub_ps(ZI, Z);
+            dist_sq = _mm256_fmadd_ps(dz, dz, dist_sq);
+        }
+
+        const __m256 is_protected = _mm256_cmp_ps(dist_sq, SQ_P, _CMP_LT_OQ);
+        // visible BUT NOT protected
+        const __m256 is_alignment = _mm256_andnot_ps(is_protected, _mm256_cmp_ps(dist_sq, SQ_V, _CMP_LT_OQ));
+
+        close_dx = _mm256_add_ps(close_dx, _mm256_and_ps(is_protected, dx));
+        close_dy = _mm256_add_ps(close_dy, _mm256_and_ps(is_protected, dy));
+        xv_avg = _mm256_add_ps(xv_avg, _mm256_and_ps(is_alignment, _mm256_loadu_ps(vx + j)));
+        yv_avg = _mm256_add_ps(yv_avg, _mm256_and_ps(is_alignment, _mm256_loadu_ps(vy + j)));
+        x_avg = _mm256_add_ps(x_avg, _mm256_and_ps(is_alignment, X));
+        y_avg = _mm256_add_ps(y_avg, _mm256_and_ps(is_alignment, Y));
+        n = _mm256_add_ps(n, _mm256_and_ps(is_alignment, ONE));
+        if constexpr (D == 3) {
+            close_dz = _mm256_add_ps(close_dz, _mm256_and_ps(is_protected, dz));
+            zv_avg = _mm256_add_ps(zv_avg, _mm256_and_ps(is_alignment, _mm256_loadu_ps(vz + j)));
+            z_avg = _mm256_add_ps(z_avg, _mm256_and_ps(is_alignment, Z));
+        }
+    }
+
+    acc.close_dx += hsum_avx(close_dx);
+    acc.close_dy += hsum_avx(close_dy);
+    acc.xv_avg += hsum_avx(xv_avg);
+    acc.yv_avg += hsum_avx(yv_avg);
+    acc.x_avg += hsum_avx(x_avg);
+    acc.y_avg += hsum_avx(y_avg);
+    acc.n_neighbours += hsum_avx(n);
+    if constexpr (D == 3) {
+        acc.close_dz += hsum_avx(close_dz);
+        acc.zv_avg += hsum_avx(zv_avg);
+        acc.z_avg += hsum_avx(z_avg);
+    }
+
+    neighbours_tail<D>(x, y, z, vx, vy, vz, j, last, xi, yi, zi, sq_protected, sq_visual, acc);
+}
+
+// Through memory: the shuffle/extract intrinsics trigger false -Wuninitialized warnings in GCC 12 headers
+__attribute__((target("avx512f")))
+inline float hsum_avx512(__m512 v) {
+    alignas(64) float lanes[16];
+    _mm512_store_ps(lanes, v);
+    float sum = 0.0f;
+    for (float lane : lanes)
+        sum += lane;
+    return sum;
+}
+
+// 16 boids per iteration, masks in k registers and masked loads for the tail (no scalar loop)
+template<int D>
+__attribute__((target("avx512f")))
+inline void neighbours_avx512(const float* x, const float* y, const float* z,
+                              const float* vx, const float* vy, const float* vz,
+                              int first, int last, float xi, float yi, float zi,
+                              float sq_protected, float sq_visual, Neighbourhood& acc) {
+    const __m512 XI = _mm512_set1_ps(xi);
+    const __m512 YI = _mm512_set1_ps(yi);
+    const __m512 ZI = _mm512_set1_ps(zi);
+    const __m512 SQ_P = _mm512_set1_ps(sq_protected);
+    const __m512 SQ_V = _mm512_set1_ps(sq_visual);
+    const __m512 ONE = _mm512_set1_ps(1.0f);
+
+    __m512 close_dx = _mm512_setzero_ps(), close_dy = _mm512_setzero_ps();
+    __m512 x_avg = _mm512_setzero_ps(), y_avg = _mm512_setzero_ps();
+    __m512 xv_avg = _mm512_setzero_ps(), yv_avg = _mm512_setzero_ps();
+    __m512 close_dz = _mm512_setzero_ps(), z_avg = _mm512_setzero_ps(), zv_avg = _mm512_setzero_ps();
+    __m512 n = _mm512_setzero_ps();
+
+    for (int j = first; j < last; j += 16) {
+        const int left = last - j;
+        const __mmask16 valid = left >= 16 ? (__mmask16)0xFFFF : (__mmask16)((1u << left) - 1);
+
+        const __m512 X = _mm512_maskz_loadu_ps(valid, x + j);
+        const __m512 Y = _mm512_maskz_loadu_ps(valid, y + j);
+        const __m512 dx = _mm512_sub_ps(XI, X);
+        const __m512 dy = _mm512_sub_ps(YI, Y);
+        __m512 dist_sq = _mm512_fmadd_ps(dx, dx, _mm512_mul_ps(dy, dy));
+        __m512 Z, dz;
+        if constexpr (D == 3) {
+            Z = _mm512_maskz_loadu_ps(valid, z + j);
+            dz = _mm512_sub_ps(ZI, Z);
+            dist_sq = _mm512_fmadd_ps(dz, dz, dist_sq);
+        }
+
+        const __mmask16 is_protected = _mm512_mask_cmp_ps_mask(valid, dist_sq, SQ_P, _CMP_LT_OQ);
+        const __mmask16 is_visible = _mm512_mask_cmp_ps_mask(valid, dist_sq, SQ_V, _CMP_LT_OQ);
+        // visible BUT NOT protected
+        const __mmask16 is_alignment = _mm512_kandn(is_protected, is_visible);
+
+        close_dx = _mm512_mask_add_ps(close_dx, is_protected, close_dx, dx);
+        close_dy = _mm512_mask_add_ps(close_dy, is_protected, close_dy, dy);
+        xv_avg = _mm512_mask_add_ps(xv_avg, is_alignment, xv_avg, _mm512_maskz_loadu_ps(valid, vx + j));
+        yv_avg = _mm512_mask_add_ps(yv_avg, is_alignment, yv_avg, _mm512_maskz_loadu_ps(valid, vy + j));
+        x_avg = _mm512_mask_add_ps(x_avg, is_alignment, x_avg, X);
+        y_avg = _mm512_mask_add_ps(y_avg, is_alignment, y_avg, Y);
+        n = _mm512_mask_add_ps(n, is_alignment, n, ONE);
+        if constexpr (D == 3) {
+            close_dz = _mm512_mask_add_ps(close_dz, is_protected, close_dz, dz);
+            zv_avg = _mm512_mask_add_ps(zv_avg, is_alignment, zv_avg, _mm512_maskz_loadu_ps(valid, vz + j));
+            z_avg = _mm512_mask_add_ps(z_avg, is_alignment, z_avg, Z);
+        }
+    }
+
+    acc.close_dx += hsum_avx512(close_dx);
+    acc.close_dy += hsum_avx512(close_dy);
+    acc.xv_avg += hsum_avx512(xv_avg);
+    acc.yv_avg += hsum_avx512(yv_avg);
+    acc.x_avg += hsum_avx512(x_avg);
+    acc.y_avg += hsum_avx512(y_avg);
+    acc.n_neighbours += hsum_avx512(n);
+    if constexpr (D == 3) {
+        acc.close_dz += hsum_avx512(close_dz);
+        acc.zv_avg += hsum_avx512(zv_avg);
+        acc.z_avg += hsum_avx512(z_avg);
+    }
+}
+
+#endif
+
+// True if the CPU can run the kernel with this name (from CPUID)
+inline bool kernel_supported(const std::string& name) {
+    if (name == "omp_simd")
+        return true;
+
+#ifdef BOIDS_X86
+    __builtin_cpu_init();
+    if (name == "avx512")
+        return __builtin_cpu_supports("avx512f");
+    if (name == "avx2")
+        return __builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma");
+    if (name == "sse42")
+        return __builtin_cpu_supports("sse4.2");
+#endif
+
+    return false;
+}
+
+/**
+ * ISA of the compiler vectorized loops (the omp simd loops of Boids_engine.h): chosen once at startup
+ * with the same CPUID checks of the kernels, the widest the CPU supports.
+ **/
+enum class LoopIsa { BASE, AVX2, AVX512 };
+
+inline LoopIsa select_loop_isa() {
+    if (kernel_supported("avx512"))
+        return LoopIsa::AVX512;
+    if (kernel_supported("avx2"))
+        return LoopIsa::AVX2;
+    return LoopIsa::BASE;
+}
+
+inline const LoopIsa LOOP_ISA = select_loop_isa();
+
+inline const char* loop_isa_name() {
+    switch (LOOP_ISA) {
+        case LoopIsa::AVX512: return "avx512";
+        case LoopIsa::AVX2:   return "avx2_fma";
+        default:              return "base";
+    }
+}
+
+#ifdef BOIDS_X86
+// Loop::run is always_inline, so it is vectorized again inside every wrapper with the ISA of the wrapper
+template<class Loop, class... Args>
+__attribute__((target("avx2,fma")))
+inline void run_loop_avx2(Args&&... args) {
+    Loop::run(std::forward<Args>(args)...);
+}
+
+template<class Loop, class... Args>
+__attribute__((target("avx512f")))
+inline void run_loop_avx512(Args&&... args) {
+    Loop::run(std::forward<Args>(args)...);
+}
+#endif
+
+// Runs Loop::run compiled for LOOP_ISA, the baseline one is inlined in the caller as before
+template<class Loop, class... Args>
+inline void run_simd_loop(Args&&... args) {
+#ifdef BOIDS_X86
+    if (LOOP_ISA == LoopIsa::AVX512)
+        return run_loop_avx512<Loop>(std::forward<Args>(args)...);
+    if (LOOP_ISA == LoopIsa::AVX2)
+        return run_loop_avx2<Loop>(std::forward<Args>(args)...);
+#endif
+    Loop::run(std::forward<Args>(args)...);
+}
+
+/**
+ * Kernel selection. "auto" takes the widest kernel the CPU supports, "omp_simd" keeps the
+ * compiler vectorized loop, otherwise the requested one ("avx512", "avx2", "sse42") if supported.
+ * D is the number of dimensions of the flock.
+ **/
+template<int D = 2>
+inline KernelInfo select_kernel(const std::string& requested) {
+    if (requested == "auto") {
+        for (const char* name : {"avx512", "avx2", "sse42"}) {
+            if (kernel_supported(name))
+                return select_kernel<D>(name);
+        }
+        return {"omp_simd", nullptr};
+    }
+
+    if (!kernel_supported(requested)) {
+        std::cerr << "Kernel " << requested << " not supported by this CPU" << std::endl;
+        exit(EXIT_FAILURE);
+    }
+
+#ifdef BOIDS_X86
+    if (requested == "avx512")
+        return {"avx512", neighbours_avx512<D>};
+    if (requested == "avx2")
+        return {"avx2_fma", neighbours_avx2<D>};
+    if (requested == "sse42")
+        return {"sse42", neighbours_sse42<D>};
+#endif
+
+    return {"omp_simd", nullptr};
+}
@@ -0,0 +1,411 @@
+//
+// Created by giacomo on 20/02/26.
+//
+
+#pragma once //to include the file only once
+
+#include "Boids_engine.h"
+#include "Frame_stats.h"
+#include "Snapshot.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <iostream>
+#include <string>
+#include <vector>
+#include <mpi.h>
+#include <omp.h>
+
+/**
+ * Distributed version (SOA_MPI): MPI ranks with OpenMP threads inside.
+ * The window is split along x in one slab per rank. Each rank keeps only the boids of its slab and,
+ * every frame:
+ *  1. sends to the neighbouring ranks its boids within VISUAL_RANGE of the border (halo) and
+ *     appends the ones it receives after its own;
+ *  2. computes the frame of its own boids with the usual engine pieces (grid, OpenMP, SIMD kernel),
+ *     the halo boids are only neighbours;
+ *  3. sends the boids that left the slab to the rank owning them now (migration). A boid moves at
+ *     most MAX_SPEED per frame and a slab is at least VISUAL_RANGE wide, so both exchanges are only
+ *     with the ranks on the left and on the right.
+ * The boids outside the window belong to the first or the last slab. Every rank draws the initial
+ * flock of --seed and keeps its part, so the run starts from the same flock of the other versions.
+ * The arrays have room for all the N boids, but only the used part is ever touched, so the memory
+ * actually resident on a node follows the boids of its ranks.
+ **/
+
+// A boid on the wire, halo or migrating (the id only matters for the migration)
+struct PackedBoid {
+    float x, y, vx, vy;
+    int id;
+};
+
+// PackedBoid as one MPI element, so the counts are boids and not bytes (an int of bytes overflows
+// around 100M boids). Created at the first use, after MPI_Init, and kept until MPI_Finalize
+inline MPI_Datatype packed_boid_type() {
+    static const MPI_Datatype type = [] {
+        MPI_Datatype t;
+        MPI_Type_contiguous((int)sizeof(PackedBoid), MPI_BYTE, &t);
+        MPI_Type_commit(&t);
+        return t;
+    }();
+    return type;
+}
+
+template<class Layout>
+struct Domain {
+    int rank, ranks;
+    int left, right;  // neighbouring ranks, MPI_PROC_NULL on the sides of the window
+    float slab_width;
+    float lo, hi;     // owned x range, unbounded on the sides of the window
+
+    bool use_grid;
+    KernelInfo kernel;
+    typename Layout::Storage boids; // own boids in [0, n_local), halo in [n_local, n_local + n_halo)
+    typename Layout::Storage boids_next;
+    Grid<Layout> grid;
+    int n_local = 0;
+    int n_halo = 0;
+    std::vector<int> ids;           // identity of the own boids
+
+    std::vector<PackedBoid> send_left, send_right, received;
+
+    long long halo_total = 0;       // over the frames, for the report
+    long long migrated_total = 0;
+};
+
+template<class Layout>
+inline Domain<Layout> allocate_domain(const Config& cfg) {
+    static_assert(Layout::D == 2, "the slab decomposition is 2D");
+    Domain<Layout> d;
+    MPI_Comm_rank(MPI_COMM_WORLD, &d.rank);
+    MPI_Comm_size(MPI_COMM_WORLD, &d.ranks);
+
+    d.slab_width = (float)Params::X_SIZE / d.ranks;
+    if (d.slab_width < Params::VISUAL_RANGE) {
+        if (d.rank == 0)
+            std::cerr << "Too many ranks: every slab must be at least VISUAL_RANGE wide (at most "
+                      << (int)(Params::X_SIZE / Params::VISUAL_RANGE) << " ranks)" << std::endl;
+        MPI_Abort(MPI_COMM_WORLD, EXIT_FAILURE);
+    }
+
+    d.left = d.rank > 0 ? d.rank - 1 : MPI_PROC_NULL;
+    d.right = d.rank < d.ranks - 1 ? d.rank + 1 : MPI_PROC_NULL;
+    d.lo = d.rank > 0 ? d.rank * d.slab_width : -INFINITY;
+    d.hi = d.rank < d.ranks - 1 ? (d.rank + 1) * d.slab_width : INFINITY;
+
+    d.use_grid = cfg.neighbours == "grid";
+    d.kernel = select_kernel(cfg.kernel);
+    d.boids = Layout::allocate(cfg.N);
+    d.boids_next = Layout::allocate(cfg.N);
+    if (d.use_grid)
+        d.grid = allocate_grid<Layout>(cfg.N, Params::X_SIZE, Params::Y_SIZE, Params::Z_SIZE, Params::VISUAL_RANGE,
+                                       cfg.threads);
+
+    return d;
+}
+
+template<class Layout>
+inline void free_domain(Domain<Layout>& d) {
+    Layout::release(d.boids);
+    Layout::release(d.boids_next);
+    if (d.use_grid)
+        free_grid(d.grid);
+}
+
+template<class Layout>
+inline int owner_of(const Domain<Layout>& d, float x) {
+    return std::clamp((int)std::floor(x / d.slab_width), 0, d.ranks - 1);
+}
+
+// Initial flock of the seed, only the boids of this slab
+template<class Layout>
+inline void init_domain(Domain<Layout>& d, int N, uint64_t seed) {
+    const uint64_t key = squares_key(seed);
+    d.n_local = 0;
+    d.ids.clear();
+
+    for (int i = 0; i < N; i++) {
+        float x, y, z, vx, vy, vz;
+        initial_boid(key, i, x, y, z, vx, vy, vz);
+        if (owner_of(d, x) == d.rank) {
+            Layout::store(d.boids, d.n_local++, x, y, vx, vy);
+            d.ids.push_back(i);
+        }
+    }
+}
+
+template<class Layout>
+inline PackedBoid pack_boid(const typename Layout::Storage& b, int i, int id) {
+    return {Layout::x(b, i), Layout::y(b, i), Layout::vx(b, i), Layout::vy(b, i), id};
+}
+
+// Sends `to_left` to the left rank and `to_right` to the right one, returns in `received` what they sent
+inline void exchange_boids(int left, int right,
+                           const std::vector<PackedBoid>& to_left, const std::vector<PackedBoid>& to_right,
+                           std::vector<PackedBoid>& received) {
+    const int send_counts[2] = {(int)to_left.size(), (int)to_right.size()};
+    int from_right = 0, from_left = 0;
+
+    MPI_Sendrecv(&send_counts[0], 1, MPI_INT, left, 0, &from_right, 1, MPI_INT, right, 0,
+                 MPI_COMM_WORLD, MPI_STATUS_IGNORE);
+    MPI_Sendrecv(&send_counts[1], 1, MPI_INT, right, 1, &from_left, 1, MPI_INT, left, 1,
+                 MPI_COMM_WORLD, MPI_STATUS_IGNORE);
+
+    received.resize((size_t)from_right + from_left);
+    MPI_Sendrecv(to_left.data(), send_counts[0], packed_boid_type(), left, 2,
+                 received.data(), from_right, packed_boid_type(), right, 2,
+                 MPI_COMM_WORLD, MPI_STATUS_IGNORE);
+    MPI_Sendrecv(to_right.data(), send_counts[1], packed_boid_type(), right, 3,
+                 received.data() + from_right, from_left, packed_boid_type(), left, 3,
+                 MPI_COMM_WORLD, MPI_STATUS_IGNORE);
+}
+
+// Halo: own boids that can see (or be seen from) the slab on the left or on the right
+template<class Layout>
+inline void exchange_halo(Domain<Layout>& d) {
+    d.send_left.clear();
+    d.send_right.clear();
+
+    for (int i = 0; i < d.n_local; i++) {
+        const float x = Layout::x(d.boids, i);
+        if (d.left != MPI_PROC_NULL && x < d.lo + Params::VISUAL_RANGE)
+            d.send_left.push_back(pack_boid<Layout>(d.boids, i, d.ids[i]));
+        if (d.right != MPI_PROC_NULL && x >= d.hi - Params::VISUAL_RANGE)
+            d.send_right.push_back(pack_boid<Layout>(d.boids, i, d.ids[i]));
+    }
+
+    exchange_boids(d.left, d.right, d.send_left, d.send_right, d.received);
+
+    d.n_halo = (int)d.received.size();
+    for (int h = 0; h < d.n_halo; h++) {
+        const PackedBoid& p = d.received[h];
+        Layout::store(d.boids, d.n_local + h, p.x, p.y, p.vx, p.vy);
+    }
+    d.halo_total += d.n_halo;
+}
+
+// Frame of the own boids, neighbours among own and halo boids
+template<class Layout, class Exec>
+inline void compute_domain(Domain<Layout>& d) {
+    const int n_total = d.n_local + d.n_halo;
+
+#pragma omp parallel if(Exec::PARALLEL) default(none) shared(d, n_total)
+    {
+        if (d.use_grid)
+            build_grid(d.grid, d.boids, n_total);
+
+        const typename Layout::Storage& b = d.use_grid ? d.grid.binned : d.boids;
+
+        // With the grid in binned order, as in step(): the halo boids are skipped
+#pragma omp for schedule(static)
+        for (int s = 0; s < n_total; s++) {
+            const int i = d.use_grid ? d.grid.order[s] : s;
+            if (i >= d.n_local)
+                continue;
+
+            float xi = Layout::x(b, s);
+            float yi = Layout::y(b, s);
+            float vxi = Layout::vx(b, s);
+            float vyi = Layout::vy(b, s);
+            float vzi = 0.0f;
+            Neighbourhood acc;
+
+            if (d.use_grid) {
+                for_each_block_range(d.grid, grid_cell(d.grid, xi, yi), [&](int first, int last) {
+                    accumulate_neighbours<Layout, Exec>(b, first, last, xi, yi, 0.0f, acc, d.kernel.fn);
+                });
+            } else {
+                accumulate_neighbours<Layout, Exec>(b, 0, n_total, xi, yi, 0.0f, acc, d.kernel.fn);
+            }
+
+            steer<2, typename Exec::Parameters>(xi, yi, 0.0f, vxi, vyi, vzi, acc);
+
+            Layout::store(d.boids_next, i, xi + vxi, yi + vyi, vxi, vyi);
+        }
+    }
+
+    std::swap(d.boids, d.boids_next);
+}
+
+// Boids that left the slab go to the neighbouring rank, the others are compacted in place
+template<class Layout>
+inline void migrate_boids(Domain<Layout>& d) {
+    d.send_left.clear();
+    d.send_right.clear();
+
+    int kept = 0;
+    for (int i = 0; i < d.n_local; i++) {
+        const int owner = owner_of(d, Layout::x(d.boids, i));
+        if (owner == d.rank) {
+            if (kept != i) {
+                Layout::store(d.boids, kept, Layout::x(d.boids, i), Layout::y(d.boids, i),
+                              Layout::vx(d.boids, i), Layout::vy(d.boids, i));
+                d.ids[kept] = d.ids[i];
+            }
+            kept++;
+        } else {
+            (owner < d.rank ? d.send_left : d.send_right).push_back(pack_boid<Layout>(d.boids, i, d.ids[i]));
+        }
+    }
+    d.migrated_total += (long long)d.send_left.size() + (long long)d.send_right.size();
+
+    exchange_boids(d.left, d.right, d.send_left, d.send_right, d.received);
+
+    d.n_local = kept;
+    d.ids.resize(kept);
+    for (const PackedBoid& p : d.received) {
+        Layout::store(d.boids, d.n_local++, p.x, p.y, p.vx, p.vy);
+        d.ids.push_back(p.id);
+    }
+}
+
+/**
+ * Whole flock on rank 0, in identity order, for the snapshot (the other ranks get an empty vector).
+ **/
+template<class Layout>
+inline std::vector<PackedBoid> gather_flock(const Domain<Layout>& d, int N) {
+    std::vector<PackedBoid> own(d.n_local);
+    for (int i = 0; i < d.n_local; i++)
+        own[i] = pack_boid<Layout>(d.boids, i, d.ids[i]);
+
+    // Counts and displacements in boids: their sum is N, an int
+    std::vector<int> counts(d.ranks), displs(d.ranks);
+    MPI_Gather(&d.n_local, 1, MPI_INT, counts.data(), 1, MPI_INT, 0, MPI_COMM_WORLD);
+    for (int r = 1; r < d.ranks; r++)
+        displs[r] = displs[r - 1] + counts[r - 1];
+
+    std::vector<PackedBoid> all(d.rank == 0 ? N : 0);
+    MPI_Gatherv(own.data(), d.n_local, packed_boid_type(), all.data(), counts.data(), displs.data(),
+                packed_boid_type(), 0, MPI_COMM_WORLD);
+
+    std::sort(all.begin(), all.end(), [](const PackedBoid& a, const PackedBoid& b) { return a.id < b.id; });
+    return all;
+}
+
+template<class Layout>
+inline void write_domain_snapshot(const Domain<Layout>& d, const std::string& path, int N, long long frame) {
+    const std::vector<PackedBoid> all = gather_flock(d, N);
+    if (d.rank != 0)
+        return;
+
+    typename Layout::Storage flock = Layout::allocate(N);
+    std::vector<int> identity(N);
+    for (int i = 0; i < N; i++) {
+        Layout::store(flock, i, all[i].x, all[i].y, all[i].vx, all[i].vy);
+        identity[i] = i;
+    }
+    write_snapshot<Layout>(path, flock, identity.data(), N, frame);
+    Layout::release(flock);
+}
+
+/**
+ * Whole distributed run, headless. The latency of a frame is the one of the slowest rank.
+ **/
+template<class Layout, class Exec>
+inline int run_distributed(Config cfg) {
+    int rank, ranks;
+    MPI_Comm_rank(MPI_COMM_WORLD, &rank);
+    MPI_Comm_size(MPI_COMM_WORLD, &ranks);
+
+    if (cfg.neighbours != "all" && cfg.neighbours != "grid") {
+        if (rank == 0)
+            std::cerr << "Unknown neighbours search: " << cfg.neighbours << std::endl;
+        MPI_Abort(MPI_COMM_WORLD, EXIT_FAILURE);
+    }
+    if (rank == 0 && (!cfg.restore.empty() || cfg.symmetric || cfg.block != 0 || cfg.reorder_every > 0
+                      || cfg.storage != "fp32" || cfg.drift || cfg.schedule != "static" || cfg.pipeline
+                      || !cfg.trajectory.empty() || cfg.neighbours == "verlet"
+                      || !cfg.params.empty() || !cfg.param.empty()))
+        std::cerr << "Warning: the distributed version supports only --N --frames --threads --csv --neighbours "
+                     "--kernel --snapshot --snapshot-every --seed --affinity --counters, the other options are ignored" << std::endl;
+
+    omp_set_num_threads(cfg.threads);
+    pin_threads(cfg.affinity);
+
+    // The seed is drawn by rank 0, every rank must start from the same flock
+    uint64_t seed = run_seed(cfg);
+    MPI_Bcast(&seed, 1, MPI_UINT64_T, 0, MPI_COMM_WORLD);
+
+    Domain<Layout> d = allocate_domain<Layout>(cfg);
+    init_domain(d, cfg.N, seed);
+
+    if (rank == 0) {
+        std::cout << "Ranks: " << ranks << ", threads per rank: " << cfg.threads << "\n";
+        std::cout << "Seed: " << seed << "\n";
+        std::cout << "Kernel: " << d.kernel.name << "\n";
+    }
+
+    // Counters of the threads of every rank around the compute only, the communication is not counted
+    PerfCounters counters;
+    if (cfg.counters)
+        open_perf_counters(counters, cfg.threads);
+
+    int iterations = 0;
+    FrameStats stats = allocate_frame_stats(cfg.frames);
+
+    while (iterations < cfg.frames) {
+        const auto start = std::chrono::steady_clock::now();
+
+        exchange_halo(d);
+        enable_perf_counters(counters);
+        compute_domain<Layout, Exec>(d);
+        disable_perf_counters(counters);
+        migrate_boids(d);
+
+        iterations++;
+
+        const auto end = std::chrono::steady_clock::now();
+        record_frame(stats, std::chrono::duration_cast<std::chrono::nanoseconds>(end - start).count());
+
+        if (!cfg.snapshot.empty() && cfg.snapshot_every > 0 && iterations % cfg.snapshot_every == 0)
+            write_domain_snapshot(d, cfg.snapshot, cfg.N, iterations);
+    }
+
+    if (!cfg.snapshot.empty())
+        write_domain_snapshot(d, cfg.snapshot, cfg.N, iterations);
+
+    // Frame by frame, the slowest rank
+    std::vector<long long> slowest(stats.recorded);
+    MPI_Reduce(stats.frame_ns.data(), slowest.data(), stats.recorded, MPI_LONG_LONG, MPI_MAX, 0, MPI_COMM_WORLD);
+
+    // Summed over the ranks, valid only if valid on every rank
+    const CounterTotals rank_counters = close_perf_counters(counters);
+    CounterTotals counter_totals;
+    int rank_valid[PERF_COUNTERS], all_valid[PERF_COUNTERS];
+    for (int k = 0; k < PERF_COUNTERS; k++)
+        rank_valid[k] = rank_counters.valid[k];
+    int rank_multiplexed = rank_counters.multiplexed, any_multiplexed = 0;
+    MPI_Reduce(rank_counters.value, counter_totals.value, PERF_COUNTERS, MPI_DOUBLE, MPI_SUM, 0, MPI_COMM_WORLD);
+    MPI_Reduce(rank_valid, all_valid, PERF_COUNTERS, MPI_INT, MPI_MIN, 0, MPI_COMM_WORLD);
+    MPI_Reduce(&rank_multiplexed, &any_multiplexed, 1, MPI_INT, MPI_MAX, 0, MPI_COMM_WORLD);
+    for (int k = 0; k < PERF_COUNTERS; k++)
+        counter_totals.valid[k] = all_valid[k];
+    counter_totals.multiplexed = any_multiplexed;
+
+    const long long rank_stats[3] = {d.n_local, d.halo_total, d.migrated_total};
+    std::vector<long long> all_stats(3 * (size_t)ranks);
+    MPI_Gather(rank_stats, 3, MPI_LONG_LONG, all_stats.data(), 3, MPI_LONG_LONG, 0, MPI_COMM_WORLD);
+
+    if (rank == 0) {
+        std::copy(slowest.begin(), slowest.end(), stats.frame_ns.begin());
+        const LatencySummary latency = summarize_frames(stats);
+        const std::string kernel = "mpi" + std::to_string(ranks) + "_" + d.kernel.name;
+
+        append_csv(cfg.csv, cfg.N, cfg.frames, cfg.threads, kernel, latency, 0, counter_totals);
+        append_latency_json(cfg.csv, cfg.N, cfg.frames, cfg.threads, kernel, latency);
+
+        printf("Frame %d duration: %.3f milliseconds\n", iterations, latency.total_ns / 1e6);
+        print_latency(latency, iterations);
+        print_perf_counters(counter_totals, iterations, cfg.N);
+        for (int r = 0; r < ranks; r++) {
+            printf("Rank %d: %lld boids, %.1f halo boids per frame, %lld migrated\n", r, all_stats[3 * r],
+                   iterations > 0 ? (double)all_stats[3 * r + 1] / iterations : 0.0, all_stats[3 * r + 2]);
+        }
+    }
+
+    free_domain(d);
+
+    return 0;
+}
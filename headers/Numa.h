@@ -0,0 +1,194 @@
+//
+// Created by giacomo on 18/02/26.
+//
+
+#pragma once //to include the file only once
+
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <iostream>
+#include <map>
+#include <string>
+#include <thread>
+#include <vector>
+#include <omp.h>
+#include <pthread.h>
+#include <sched.h>
+#include <unistd.h>
+
+#ifdef BOIDS_NUMA
+#include <numa.h>
+#include <numaif.h>
+#endif
+
+/**
+ * NUMA placement of the boids. Linux puts a page on the node of the thread that writes it first,
+ * so every array is first-touched in parallel with the same schedule(static) partition of the frame
+ * loops: each thread then finds its part of the flock in its local memory.
+ * This only holds if the threads don't move, so --affinity pins them:
+ *  - close: thread t on the t-th allowed cpu, with the cpus sorted by node, so a socket is filled before the next one;
+ *  - spread: the allowed cpus taken round robin over the nodes, so every socket gets threads.
+ * With libnuma (BOIDS_NUMA, set by CMake when it is found) the run reports on which node the pages of
+ * the boids are and how many are on the node of the thread that uses them.
+ * Pinning includes the master thread, and a std::thread inherits the mask of its creator: the helper
+ * threads (renderer, trajectory writer) get back the cpus of the process with unpin_thread(), or they
+ * would share the cpu of OpenMP thread 0.
+ **/
+
+// The cpus of the process, as the master thread found them before pin_threads() pinned it
+inline const cpu_set_t& allowed_cpus() {
+    static const cpu_set_t allowed = [] {
+        cpu_set_t set;
+        CPU_ZERO(&set);
+        sched_getaffinity(0, sizeof(set), &set);
+        return set;
+    }();
+    return allowed;
+}
+
+inline int node_of_cpu(int cpu) {
+#ifdef BOIDS_NUMA
+    if (numa_available() >= 0)
+        return std::max(numa_node_of_cpu(cpu), 0);
+#endif
+    (void)cpu;
+    return 0;
+}
+
+inline void pin_threads(const std::string& affinity) {
+    if (affinity == "none")
+        return;
+    if (affinity != "close" && affinity != "spread") {
+        std::cerr << "Unknown affinity: " << affinity << std::endl;
+        exit(EXIT_FAILURE);
+    }
+
+    // Not the current mask: a sweep pins again at every point, with the master already on one cpu
+    const cpu_set_t& allowed = allowed_cpus();
+
+    std::vector<int> cpus;
+    for (int c = 0; c < CPU_SETSIZE; c++) {
+        if (CPU_ISSET(c, &allowed))
+            cpus.push_back(c);
+    }
+
+    // close: a node after the other, whatever the numbering of the cpus (on some machines it alternates the sockets)
+    if (affinity == "close")
+        std::stable_sort(cpus.begin(), cpus.end(), [](int a, int b) { return node_of_cpu(a) < node_of_cpu(b); });
+
+    if (affinity == "spread") {
+        std::map<int, std::vector<int>> by_node;
+        for (int c : cpus)
+            by_node[node_of_cpu(c)].push_back(c);
+
+        cpus.clear();
+        for (size_t k = 0; cpus.size() < (size_t)CPU_COUNT(&allowed); k++) {
+            for (auto& [node, node_cpus] : by_node) {
+                if (k < node_cpus.size())
+                    cpus.push_back(node_cpus[k]);
+            }
+        }
+    }
+
+    std::vector<int> pinned(omp_get_max_threads(), -1);
+
+#pragma omp parallel
+    {
+        const int tid = omp_get_thread_num();
+        const int cpu = cpus[tid % cpus.size()];
+        cpu_set_t set;
+        CPU_ZERO(&set);
+        CPU_SET(cpu, &set);
+        if (pthread_setaffinity_np(pthread_self(), sizeof(set), &set) == 0)
+            pinned[tid] = cpu;
+    }
+
+    std::cout << "Affinity: " << affinity << ", threads on cpus";
+    for (int cpu : pinned)
+        std::cout << " " << cpu;
+    std::cout << "\n";
+}
+
+// A helper thread created after pin_threads() back on every cpu of the process
+inline void unpin_thread(std::thread& thread) {
+    if (thread.joinable())
+        pthread_setaffinity_np(thread.native_handle(), sizeof(cpu_set_t), &allowed_cpus());
+}
+
+// Writes every element once with the static partition of the frame loops, before the real data
+template<class Layout>
+inline void first_touch(typename Layout::Storage& boids, int N) {
+#pragma omp parallel for schedule(static)
+    for (int i = 0; i < N; i++)
+        Layout::store(boids, i, 0.0f, 0.0f, 0.0f, 0.0f);
+}
+
+template<class T>
+inline void first_touch_array(T* values, int N) {
+#pragma omp parallel for schedule(static)
+    for (int i = 0; i < N; i++)
+        values[i] = T{};
+}
+
+/**
+ * Pages of the boids per node, from the address of the first field (the other arrays of the SOA
+ * layouts are touched by the same loops). The node expected for a page is the node of the thread
+ * that owns its first boid in the static partition.
+ **/
+template<class Layout>
+inline void report_placement(const typename Layout::Storage& boids, int N, const char* what) {
+#ifdef BOIDS_NUMA
+    if (numa_available() < 0 || N == 0)
+        return;
+
+    const long page_size = sysconf(_SC_PAGESIZE);
+    std::vector<void*> pages;
+    std::vector<int> expected;
+    const char* last_page = nullptr;
+
+    // Boid by boid in the order of the static partition, one sample for every new page
+    std::vector<int> node_of_boid(N);
+#pragma omp parallel
+    {
+        const int node = node_of_cpu(sched_getcpu());
+#pragma omp for schedule(static)
+        for (int i = 0; i < N; i++)
+            node_of_boid[i] = node;
+    }
+
+    for (int i = 0; i < N; i++) {
+        const char* page = (const char*)((uintptr_t)Layout::address(boids, i) & ~(uintptr_t)(page_size - 1));
+        if (page != last_page) {
+            pages.push_back((void*)page);
+            expected.push_back(node_of_boid[i]);
+            last_page = page;
+        }
+    }
+
+    std::vector<int> status(pages.size(), -1);
+    if (move_pages(0, pages.size(), pages.data(), nullptr, status.data(), 0) != 0)
+        return;
+
+    std::map<int, long> per_node;
+    long local = 0;
+    for (size_t p = 0; p < pages.size(); p++) {
+        per_node[status[p]]++;
+        local += status[p] == expected[p];
+    }
+
+    std::cout << "NUMA placement of " << what << ":";
+    for (auto& [node, count] : per_node) {
+        if (node >= 0)
+            std::cout << " node " << node << " " << count << " pages,";
+        else
+            std::cout << " not resident " << count << " pages,";
+    }
+    printf(" %.1f%% on the node of their thread\n", 100.0 * local / pages.size());
+#else
+    (void)boids;
+    (void)N;
+    (void)what;
+#endif
+}
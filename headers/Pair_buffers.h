@@ -0,0 +1,87 @@
+//
+// Created by giacomo on 16/02/26.
+//
+
+#pragma once //to include the file only once
+
+#include "Kernels_SIMD.h"
+
+#include <algorithm>
+#include <cstdlib>
+#include <iostream>
+#include <omp.h>
+
+/**
+ * Per-thread accumulation buffers of the symmetric pair kernel (--symmetric).
+ * Every unordered pair (i, j) is evaluated once, by the thread owning row i: its contribution to i
+ * stays in registers, the one to j is scattered in the buffer of the thread. The buffers are then
+ * reduced over the threads, boid by boid, in parallel. Each thread has one array per field of
+ * Neighbourhood (SOA, 32-byte aligned), so the scatter of the SIMD loop is a contiguous store.
+ * A 2D flock uses the first PAIR_FIELDS_2D fields, a 3D one all of them.
+ **/
+
+constexpr int PAIR_FIELDS = 10; // same order as Neighbourhood
+constexpr int PAIR_FIELDS_2D = 7;
+enum PairField { PAIR_X_AVG, PAIR_Y_AVG, PAIR_XV_AVG, PAIR_YV_AVG, PAIR_N_NEIGHBOURS, PAIR_CLOSE_DX, PAIR_CLOSE_DY,
+                 PAIR_Z_AVG, PAIR_ZV_AVG, PAIR_CLOSE_DZ };
+
+struct PairBuffers {
+    int n_threads;
+    int fields;    // PAIR_FIELDS_2D or PAIR_FIELDS
+    size_t stride; // floats per field, padded to 32 bytes
+    float* data;   // n_threads * fields * stride
+};
+
+inline PairBuffers allocate_pair_buffers(int N, int n_threads, int dims = 2) {
+    PairBuffers buffers;
+    buffers.n_threads = n_threads;
+    buffers.fields = dims == 3 ? PAIR_FIELDS : PAIR_FIELDS_2D;
+    buffers.stride = ((size_t)N + 7) / 8 * 8;
+
+    const size_t bytes = (size_t)n_threads * buffers.fields * buffers.stride * sizeof(float);
+    buffers.data = static_cast<float*>(std::aligned_alloc(32, std::max(bytes, (size_t)32)));
+    if (!buffers.data) {
+        std::cerr << "Allocation of the pair buffers failed" << std::endl;
+        exit(EXIT_FAILURE);
+    }
+
+    return buffers;
+}
+
+inline void free_pair_buffers(PairBuffers& buffers) {
+    std::free(buffers.data);
+    buffers.data = nullptr;
+}
+
+inline float* pair_field(const PairBuffers& buffers, int thread, int field) {
+    return buffers.data + ((size_t)thread * buffers.fields + field) * buffers.stride;
+}
+
+// Every thread clears only its own buffer, so no barrier is needed before the scatter
+inline void clear_pair_buffer(PairBuffers& buffers, int N) {
+    const int tid = omp_get_thread_num();
+    for (int f = 0; f < buffers.fields; f++)
+        std::fill(pair_field(buffers, tid, f), pair_field(buffers, tid, f) + N, 0.0f);
+}
+
+// Sum over the threads of the team of what was scattered on boid i
+inline Neighbourhood reduce_pair_buffers(const PairBuffers& buffers, int n_threads, int i) {
+    float sum[PAIR_FIELDS] = {};
+    for (int t = 0; t < n_threads; t++) {
+        for (int f = 0; f < buffers.fields; f++)
+            sum[f] += pair_field(buffers, t, f)[i];
+    }
+
+    Neighbourhood acc;
+    acc.x_avg = sum[PAIR_X_AVG];
+    acc.y_avg = sum[PAIR_Y_AVG];
+    acc.xv_avg = sum[PAIR_XV_AVG];
+    acc.yv_avg = sum[PAIR_YV_AVG];
+    acc.n_neighbours = sum[PAIR_N_NEIGHBOURS];
+    acc.close_dx = sum[PAIR_CLOSE_DX];
+    acc.close_dy = sum[PAIR_CLOSE_DY];
+    acc.z_avg = sum[PAIR_Z_AVG];
+    acc.zv_avg = sum[PAIR_ZV_AVG];
+    acc.close_dz = sum[PAIR_CLOSE_DZ];
+    return acc;
+}
@@ -0,0 +1,219 @@
+//
+// Created by giacomo on 26/02/26.
+//
+
+#pragma once //to include the file only once
+
+#include <cerrno>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+#include <vector>
+#include <omp.h>
+
+#ifdef __linux__
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+/**
+ * Hardware counters of the frame (--counters), with perf_event_open on Linux.
+ * Every OpenMP thread opens one group for itself (cycles, instructions, L1d read misses, last level
+ * cache misses, dTLB read misses, branch misses), user space only, so perf_event_paranoid <= 2 is enough.
+ * The groups start disabled and the frame loop enables them just around the parallel region of the
+ * frame (step(), or the compute of the rank with MPI), one ioctl per thread: the graphics, the snapshots
+ * and the writer threads are not counted. The threads of the team stay the same from one region to the
+ * next, so the group of a thread keeps counting the same share of the frame.
+ * At the end the groups are read once, summed over the threads and written in the csv next to the timing.
+ * The counts include the spin of the threads waiting at the final barrier: compare the instructions
+ * per boid of two layouts, not the IPC of an unbalanced run. When the PMU has fewer counters than the
+ * group needs, the kernel multiplexes it and the values are scaled by time enabled / time running.
+ * Counters the machine doesn't have (e.g. in a VM without a virtual PMU) are left empty.
+ **/
+
+constexpr int PERF_COUNTERS = 6;
+constexpr const char* PERF_COUNTER_NAMES[PERF_COUNTERS] = {
+    "cycles", "instructions", "l1d_misses", "llc_misses", "dtlb_misses", "branch_misses"
+};
+
+// Summed over the threads for the whole run, valid[k] false when counter k couldn't be opened
+struct CounterTotals {
+    bool valid[PERF_COUNTERS] = {};
+    double value[PERF_COUNTERS] = {};
+    bool multiplexed = false;
+};
+
+struct PerfCounters {
+    bool enabled = false;
+    std::vector<int> leader;  // group of every thread, -1 if none
+    std::vector<int> fd;      // n_threads * PERF_COUNTERS, -1 for the counters not opened
+    int open_error = 0;       // errno of the first failure, for the warning
+};
+
+#ifdef __linux__
+constexpr uint64_t perf_cache_event(uint64_t cache, uint64_t op, uint64_t result) {
+    return cache | (op << 8) | (result << 16);
+}
+
+inline int open_perf_event(int k, int group) {
+    static constexpr uint32_t TYPE[PERF_COUNTERS] = {
+        PERF_TYPE_HARDWARE, PERF_TYPE_HARDWARE, PERF_TYPE_HW_CACHE,
+        PERF_TYPE_HARDWARE, PERF_TYPE_HW_CACHE, PERF_TYPE_HARDWARE
+    };
+    static constexpr uint64_t CONFIG[PERF_COUNTERS] = {
+        PERF_COUNT_HW_CPU_CYCLES,
+        PERF_COUNT_HW_INSTRUCTIONS,
+        perf_cache_event(PERF_COUNT_HW_CACHE_L1D, PERF_COUNT_HW_CACHE_OP_READ, PERF_COUNT_HW_CACHE_RESULT_MISS),
+        PERF_COUNT_HW_CACHE_MISSES, // generic event, the last level cache on the usual x86 PMUs
+        perf_cache_event(PERF_COUNT_HW_CACHE_DTLB, PERF_COUNT_HW_CACHE_OP_READ, PERF_COUNT_HW_CACHE_RESULT_MISS),
+        PERF_COUNT_HW_BRANCH_MISSES
+    };
+
+    perf_event_attr attr;
+    std::memset(&attr, 0, sizeof(attr));
+    attr.size = sizeof(attr);
+    attr.type = TYPE[k];
+    attr.config = CONFIG[k];
+    attr.disabled = group == -1; // the members follow the leader
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+    attr.read_format = PERF_FORMAT_GROUP | PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+
+    // pid 0, cpu -1: the calling thread, on any CPU
+    return (int)syscall(SYS_perf_event_open, &attr, 0, -1, group, 0);
+}
+#endif
+
+/**
+ * Opens the groups, every thread its own: call it after omp_set_num_threads() and the pinning.
+ * Without a single counter available the run goes on without them, with a warning.
+ **/
+inline void open_perf_counters(PerfCounters& pc, int n_threads) {
+    pc.leader.assign(n_threads, -1);
+    pc.fd.assign((size_t)n_threads * PERF_COUNTERS, -1);
+
+#ifdef __linux__
+#pragma omp parallel num_threads(n_threads) default(none) shared(pc)
+    {
+        const int tid = omp_get_thread_num();
+        int& leader = pc.leader[tid];
+        for (int k = 0; k < PERF_COUNTERS; k++) {
+            const int fd = open_perf_event(k, leader);
+            if (fd < 0) {
+#pragma omp atomic write
+                pc.open_error = errno;
+                continue;
+            }
+            pc.fd[(size_t)tid * PERF_COUNTERS + k] = fd;
+            if (leader == -1)
+                leader = fd;
+        }
+    }
+#endif
+
+    for (int fd : pc.leader)
+        pc.enabled |= fd != -1;
+
+    if (!pc.enabled)
+        std::cerr << "Warning: no hardware counter available (perf_event_open: "
+                  << (pc.open_error ? std::strerror(pc.open_error) : "not supported") << "), --counters ignored" << std::endl;
+}
+
+// Around the parallel region of the frame, from the thread running the frame loop
+inline void enable_perf_counters(const PerfCounters& pc) {
+#ifdef __linux__
+    if (!pc.enabled)
+        return;
+    for (int fd : pc.leader) {
+        if (fd != -1)
+            ioctl(fd, PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP);
+    }
+#else
+    (void)pc;
+#endif
+}
+
+inline void disable_perf_counters(const PerfCounters& pc) {
+#ifdef __linux__
+    if (!pc.enabled)
+        return;
+    for (int fd : pc.leader) {
+        if (fd != -1)
+            ioctl(fd, PERF_EVENT_IOC_DISABLE, PERF_IOC_FLAG_GROUP);
+    }
+#else
+    (void)pc;
+#endif
+}
+
+/**
+ * Reads every group once and closes it. A counter is valid only if every thread could open it,
+ * so the sum never misses a thread.
+ **/
+inline CounterTotals close_perf_counters(PerfCounters& pc) {
+    CounterTotals totals;
+    if (!pc.enabled)
+        return totals;
+
+    const int n_threads = (int)pc.leader.size();
+    for (int k = 0; k < PERF_COUNTERS; k++) {
+        totals.valid[k] = true;
+        for (int t = 0; t < n_threads; t++)
+            totals.valid[k] &= pc.fd[(size_t)t * PERF_COUNTERS + k] != -1;
+    }
+
+#ifdef __linux__
+    // nr, time enabled, time running, then the values in the order the members joined the group
+    std::vector<uint64_t> data(3 + PERF_COUNTERS);
+    for (int t = 0; t < n_threads; t++) {
+        if (pc.leader[t] == -1)
+            continue;
+        if (read(pc.leader[t], data.data(), data.size() * sizeof(uint64_t)) <= 0)
+            continue;
+
+        const uint64_t enabled = data[1];
+        const uint64_t running = data[2];
+        const double scale = running > 0 ? (double)enabled / running : 0.0;
+        totals.multiplexed |= running < enabled;
+
+        int member = 0;
+        for (int k = 0; k < PERF_COUNTERS; k++) {
+            if (pc.fd[(size_t)t * PERF_COUNTERS + k] == -1)
+                continue;
+            totals.value[k] += data[3 + member] * scale;
+            member++;
+        }
+    }
+
+    for (int fd : pc.fd) {
+        if (fd != -1)
+            close(fd);
+    }
+#endif
+
+    pc.enabled = false;
+    return totals;
+}
+
+// Per frame and per boid, with the instructions per cycle, only the counters that were available
+inline void print_perf_counters(const CounterTotals& totals, int frames, long long N) {
+    bool any = false;
+    for (bool v : totals.valid)
+        any |= v;
+    if (!any || frames <= 0)
+        return;
+
+    printf("Hardware counters (user space, summed over the threads%s):\n", totals.multiplexed ? ", multiplexed and scaled" : "");
+    for (int k = 0; k < PERF_COUNTERS; k++) {
+        if (totals.valid[k])
+            printf("  %-14s %16.0f per frame %12.2f per boid\n", PERF_COUNTER_NAMES[k],
+                   totals.value[k] / frames, totals.value[k] / frames / N);
+        else
+            printf("  %-14s n/a\n", PERF_COUNTER_NAMES[k]);
+    }
+    if (totals.valid[0] && totals.valid[1] && totals.value[0] > 0)
+        printf("  IPC %.2f\n", totals.value[1] / totals.value[0]);
+}
@@ -0,0 +1,119 @@
+//
+// Created by giacomo on 15/02/26.
+//
+
+#pragma once //to include the file only once
+
+#include <atomic>
+#include <vector>
+#include <omp.h>
+#include <SFML/Graphics.hpp>
+
+/**
+ * Pipelined mode (--pipeline): a dedicated render thread draws frame k while the OpenMP team
+ * computes frame k+1, so a frame costs about max(simulation, rendering) instead of their sum.
+ * The hand-off is a lock-free triple buffer of positions: after every step the main thread copies
+ * the positions into the back slot and publishes it with one atomic exchange, the render thread
+ * takes the latest published slot with another exchange. The simulation never waits: if the renderer
+ * is slower some frames are simply not drawn. If it is faster it sleeps on the counter of published
+ * frames (atomic wait/notify) until the next one, it doesn't spin and doesn't draw a frame twice, so
+ * its core is left to the OpenMP team.
+ * Events are still polled by the main thread, which created the window (as SFML requires),
+ * the render thread only activates the OpenGL context and draws.
+ **/
+
+struct PublishedFrame {
+    std::vector<float> xy; // x0, y0, x1, y1, ...
+    long long frame = -1;
+};
+
+struct RenderPipeline {
+    PublishedFrame slots[3];
+    std::atomic<int> ready{0};  // index of the last published slot | FRESH if not taken yet
+    int back = 1;               // slot written by the simulation (main thread only)
+    int front = 2;              // slot read by the render thread (render thread only)
+
+    std::atomic<long long> published{0}; // frames published so far, the render thread waits on it
+    std::atomic<bool> stop{false};
+    std::atomic<long long> drawn{0};
+
+    static constexpr int FRESH = 4;
+};
+
+inline void allocate_pipeline(RenderPipeline& pipeline, int N) {
+    for (PublishedFrame& slot : pipeline.slots)
+        slot.xy.resize(2 * (size_t)N);
+}
+
+// Main thread, after a step: copies the positions in identity order (with the OpenMP team) and publishes them
+template<class Layout>
+inline void publish_frame(RenderPipeline& pipeline, const typename Layout::Storage& boids, const int* slot_of,
+                          int N, long long frame) {
+    PublishedFrame& slot = pipeline.slots[pipeline.back];
+    float* xy = slot.xy.data();
+
+#pragma omp parallel for schedule(static)
+    for (int i = 0; i < N; i++) {
+        xy[2 * i] = Layout::x(boids, slot_of[i]);
+        xy[2 * i + 1] = Layout::y(boids, slot_of[i]);
+    }
+    slot.frame = frame;
+
+    pipeline.back = pipeline.ready.exchange(pipeline.back | RenderPipeline::FRESH, std::memory_order_acq_rel)
+                    & ~RenderPipeline::FRESH;
+    pipeline.published.fetch_add(1, std::memory_order_release);
+    pipeline.published.notify_one();
+}
+
+// Main thread, at the end of the run: wakes the render thread and lets it return
+inline void stop_pipeline(RenderPipeline& pipeline) {
+    pipeline.stop.store(true, std::memory_order_release);
+    pipeline.published.fetch_add(1, std::memory_order_release);
+    pipeline.published.notify_one();
+}
+
+// Render thread: takes the latest published slot, if there is a new one
+inline const PublishedFrame* take_frame(RenderPipeline& pipeline) {
+    if (pipeline.ready.load(std::memory_order_acquire) & RenderPipeline::FRESH)
+        pipeline.front = pipeline.ready.exchange(pipeline.front, std::memory_order_acq_rel) & ~RenderPipeline::FRESH;
+
+    const PublishedFrame& slot = pipeline.slots[pipeline.front];
+    return slot.frame >= 0 ? &slot : nullptr;
+}
+
+/**
+ * Body of the render thread. The vertices are filled serially: an OpenMP team here would compete
+ * for the cores with the simulation team.
+ **/
+inline void render_loop(RenderPipeline& pipeline, sf::RenderWindow& window,
+                        const sf::Vector2f* triangle, int N) {
+    (void)window.setActive(true);
+    sf::VertexArray vertices(sf::PrimitiveType::Triangles, 3 * (size_t)N);
+    long long seen = 0;
+    long long last_drawn = -1;
+
+    while (true) {
+        // Asleep until a frame is published (or the run ends)
+        pipeline.published.wait(seen, std::memory_order_acquire);
+        seen = pipeline.published.load(std::memory_order_acquire);
+        if (pipeline.stop.load(std::memory_order_acquire))
+            break;
+
+        const PublishedFrame* frame = take_frame(pipeline);
+        if (!frame || frame->frame == last_drawn) // already taken before the counter moved
+            continue;
+
+        for (int i = 0; i < N; i++) {
+            for (int k = 0; k < 3; k++)
+                vertices[3 * i + k].position = {frame->xy[2 * i] + triangle[k].x, frame->xy[2 * i + 1] + triangle[k].y};
+        }
+        last_drawn = frame->frame;
+
+        window.clear(sf::Color::Black);
+        window.draw(vertices);
+        window.display();
+        pipeline.drawn.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    (void)window.setActive(false);
+}
@@ -0,0 +1,152 @@
+//
+// Created by giacomo on 19/02/26.
+//
+
+#pragma once //to include the file only once
+
+#include <algorithm>
+#include <iostream>
+#include <string>
+#include <utility>
+#include <vector>
+#include <omp.h>
+
+/**
+ * Periodic reordering of the storage along a space-filling curve (--reorder k, --curve).
+ * Without it the boids keep the random order of the initialization, so two neighbours in space are
+ * anywhere in the arrays. Every k frames the boids are sorted by the Morton or Hilbert index of their
+ * position on a 256x256 lattice over the window, with the same parallel counting sort of the grid
+ * (per-thread histograms, scan, stable scatter), so boids close in space end up in close cache lines.
+ * The storage index of a boid changes, its identity doesn't: id_of/slot_of of the simulation keep
+ * the permutation, and rendering, snapshots and drift report read the boids in identity order.
+ * In 3D the curve is on the x-y projection: the boids of a column end up close, which is still most
+ * of the locality with a flock as deep as the window is tall.
+ **/
+
+constexpr int CURVE_BITS = 8;
+constexpr int CURVE_SIDE = 1 << CURVE_BITS;
+constexpr int CURVE_CELLS = CURVE_SIDE * CURVE_SIDE;
+
+// Interleaves the bits of x and y (x in the even bits)
+inline int morton_key(int x, int y) {
+    int key = 0;
+    for (int b = 0; b < CURVE_BITS; b++)
+        key |= ((x >> b) & 1) << (2 * b) | ((y >> b) & 1) << (2 * b + 1);
+    return key;
+}
+
+// Distance along the Hilbert curve of the lattice point (x, y): consecutive keys are always adjacent cells
+inline int hilbert_key(int x, int y) {
+    int key = 0;
+    for (int s = CURVE_SIDE / 2; s > 0; s /= 2) {
+        const int rx = (x & s) > 0;
+        const int ry = (y & s) > 0;
+        key += s * s * ((3 * rx) ^ ry);
+
+        // rotation of the quadrant
+        if (ry == 0) {
+            if (rx == 1) {
+                x = CURVE_SIDE - 1 - x;
+                y = CURVE_SIDE - 1 - y;
+            }
+            std::swap(x, y);
+        }
+    }
+    return key;
+}
+
+struct Reordering {
+    int every = 0;      // frames between two passes, 0 = never
+    bool hilbert = true;
+    float width, height;
+    int passes = 0;
+
+    std::vector<int> key;           // curve index of every boid (storage index)
+    std::vector<int> thread_offset; // n_threads * CURVE_CELLS, per-thread histograms and then offsets
+    std::vector<int> new_id_of;     // id_of after the pass
+    std::vector<float> new_cost;    // cost after the pass (see the balanced schedule)
+};
+
+inline Reordering allocate_reordering(int N, int every, const std::string& curve,
+                                      float width, float height, int n_threads) {
+    if (curve != "morton" && curve != "hilbert") {
+        std::cerr << "Unknown curve: " << curve << std::endl;
+        exit(EXIT_FAILURE);
+    }
+
+    Reordering reordering;
+    reordering.every = every;
+    reordering.hilbert = curve == "hilbert";
+    reordering.width = width;
+    reordering.height = height;
+    if (every > 0) {
+        reordering.key.resize(N);
+        reordering.thread_offset.resize((size_t)n_threads * CURVE_CELLS);
+        reordering.new_id_of.resize(N);
+        reordering.new_cost.resize(N);
+    }
+    return reordering;
+}
+
+// Boids outside the window are clamped on the border of the lattice
+inline int curve_key(const Reordering& reordering, float x, float y) {
+    const int cx = (int)std::clamp(x / reordering.width * CURVE_SIDE, 0.0f, (float)(CURVE_SIDE - 1));
+    const int cy = (int)std::clamp(y / reordering.height * CURVE_SIDE, 0.0f, (float)(CURVE_SIDE - 1));
+    return reordering.hilbert ? hilbert_key(cx, cy) : morton_key(cx, cy);
+}
+
+/**
+ * One pass: boids sorted by key from `boids` into `scratch`, which then are swapped.
+ * id_of (storage index -> boid), slot_of (boid -> storage index) and cost follow the boids.
+ **/
+template<class Layout>
+inline void reorder_boids(Reordering& reordering, typename Layout::Storage& boids, typename Layout::Storage& scratch,
+                          int N, std::vector<int>& id_of, std::vector<int>& slot_of, std::vector<float>& cost) {
+#pragma omp parallel default(none) shared(reordering, boids, scratch, N, id_of, slot_of, cost)
+    {
+        const int tid = omp_get_thread_num();
+        int* offset = reordering.thread_offset.data() + (size_t)tid * CURVE_CELLS;
+
+        std::fill(offset, offset + CURVE_CELLS, 0);
+
+#pragma omp for schedule(static)
+        for (int i = 0; i < N; i++) {
+            const int k = curve_key(reordering, Layout::x(boids, i), Layout::y(boids, i));
+            reordering.key[i] = k;
+            offset[k]++;
+        }
+
+        // Exclusive scan key by key, inside a key thread by thread
+#pragma omp single
+        {
+            const int n_threads = omp_get_num_threads();
+            int running = 0;
+            for (int k = 0; k < CURVE_CELLS; k++) {
+                for (int t = 0; t < n_threads; t++) {
+                    int& slot = reordering.thread_offset[(size_t)t * CURVE_CELLS + k];
+                    const int count = slot;
+                    slot = running;
+                    running += count;
+                }
+            }
+        }
+
+        // Same static partition of the counting loop, so the sort is stable
+#pragma omp for schedule(static)
+        for (int i = 0; i < N; i++) {
+            const int pos = offset[reordering.key[i]]++;
+            Layout::copy(scratch, pos, boids, i);
+            reordering.new_id_of[pos] = id_of[i];
+            reordering.new_cost[pos] = cost[i];
+        }
+
+#pragma omp for schedule(static)
+        for (int pos = 0; pos < N; pos++)
+            slot_of[reordering.new_id_of[pos]] = pos;
+    }
+
+    std::swap(boids, scratch);
+    id_of.swap(reordering.new_id_of);
+    cost.swap(reordering.new_cost);
+    reordering.passes++;
+}
@@ -0,0 +1,265 @@
+//
+// Created by giacomo on 27/02/26.
+//
+
+#pragma once //to include the file only once
+
+#include "Kernels_SIMD.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+#include <string>
+#include <omp.h>
+
+/**
+ * Limits of the machine for the roofline harness (Roofline.cpp), measured with the threads of the run:
+ *  - peak_flops: independent chains of FMAs in registers, with the widest vector ISA supported
+ *    (the same CPUID check of the kernels), so it is the compute roof of the hand-written kernels;
+ *  - stream_triad: a[i] = b[i] + s * c[i] on float arrays, counted like STREAM (12 bytes per element,
+ *    no write-allocate). With arrays much larger than the last level cache it is the DRAM roof, with
+ *    the working set of a kernel it is the roof of the cache level that kernel streams from.
+ **/
+
+constexpr int FMA_CHAINS = 12; // enough independent FMAs to cover latency * ports on current cores
+constexpr long long FMA_ITERATIONS = 1 << 22;
+
+struct VectorIsa {
+    const char* name;
+    int lanes; // floats per register
+};
+
+// The widest vector ISA of the CPU, with the same CPUID checks of the kernels
+inline VectorIsa widest_isa() {
+    if (kernel_supported("avx512"))
+        return {"avx512", 16};
+    if (kernel_supported("avx2"))
+        return {"avx2_fma", 8};
+    if (kernel_supported("sse42"))
+        return {"sse42", 4};
+    return {"generic", 8};
+}
+
+struct FlopsRoof {
+    const char* isa;
+    double gflops;
+};
+
+#ifdef BOIDS_X86
+__attribute__((target("avx512f")))
+inline float fma_chains_avx512(long long iterations) {
+    __m512 acc[FMA_CHAINS];
+#pragma GCC unroll 16
+    for (int k = 0; k < FMA_CHAINS; k++)
+        acc[k] = _mm512_set1_ps(1.0f + k * 1e-3f);
+    const __m512 a = _mm512_set1_ps(0.9999999f);
+    const __m512 b = _mm512_set1_ps(1e-7f);
+
+    for (long long it = 0; it < iterations; it++) {
+#pragma GCC unroll 16 // the chains must stay in registers
+        for (int k = 0; k < FMA_CHAINS; k++)
+            acc[k] = _mm512_fmadd_ps(acc[k], a, b);
+    }
+
+    __m512 sum = acc[0];
+#pragma GCC unroll 16
+    for (int k = 1; k < FMA_CHAINS; k++)
+        sum = _mm512_add_ps(sum, acc[k]);
+    return hsum_avx512(sum);
+}
+
+__attribute__((target("avx2,fma")))
+inline float fma_chains_avx2(long long iterations) {
+    __m256 acc[FMA_CHAINS];
+#pragma GCC unroll 16
+    for (int k = 0; k < FMA_CHAINS; k++)
+        acc[k] = _mm256_set1_ps(1.0f + k * 1e-3f);
+    const __m256 a = _mm256_set1_ps(0.9999999f);
+    const __m256 b = _mm256_set1_ps(1e-7f);
+
+    for (long long it = 0; it < iterations; it++) {
+#pragma GCC unroll 16 // the chains must stay in registers
+        for (int k = 0; k < FMA_CHAINS; k++)
+            acc[k] = _mm256_fmadd_ps(acc[k], a, b);
+    }
+
+    __m256 sum = acc[0];
+#pragma GCC unroll 16
+    for (int k = 1; k < FMA_CHAINS; k++)
+        sum = _mm256_add_ps(sum, acc[k]);
+    return hsum_avx(sum);
+}
+
+// No FMA before AVX2: a multiply and an add, still 2 flops per lane
+__attribute__((target("sse4.2")))
+inline float fma_chains_sse(long long iterations) {
+    __m128 acc[FMA_CHAINS];
+#pragma GCC unroll 16
+    for (int k = 0; k < FMA_CHAINS; k++)
+        acc[k] = _mm_set1_ps(1.0f + k * 1e-3f);
+    const __m128 a = _mm_set1_ps(0.9999999f);
+    const __m128 b = _mm_set1_ps(1e-7f);
+
+    for (long long it = 0; it < iterations; it++) {
+#pragma GCC unroll 16 // the chains must stay in registers
+        for (int k = 0; k < FMA_CHAINS; k++)
+            acc[k] = _mm_add_ps(_mm_mul_ps(acc[k], a), b);
+    }
+
+    __m128 sum = acc[0];
+#pragma GCC unroll 16
+    for (int k = 1; k < FMA_CHAINS; k++)
+        sum = _mm_add_ps(sum, acc[k]);
+    return hsum_sse(sum);
+}
+#endif
+
+// Compiler vectorized chains, for the CPUs without the kernels above
+inline float fma_chains_generic(long long iterations) {
+    constexpr int LANES = 8;
+    float acc[FMA_CHAINS * LANES];
+    for (int k = 0; k < FMA_CHAINS * LANES; k++)
+        acc[k] = 1.0f + k * 1e-3f;
+
+    for (long long it = 0; it < iterations; it++) {
+#pragma omp simd
+        for (int k = 0; k < FMA_CHAINS * LANES; k++)
+            acc[k] = acc[k] * 0.9999999f + 1e-7f;
+    }
+
+    float sum = 0.0f;
+    for (float v : acc)
+        sum += v;
+    return sum;
+}
+
+// Every thread runs its chains, the roof is the best of `reps` timings of the whole team
+inline FlopsRoof peak_flops(int threads, int reps) {
+    const VectorIsa isa = widest_isa();
+    const std::string name = isa.name;
+
+    double best = 0.0;
+    float sink = 0.0f;
+    for (int r = 0; r < reps; r++) {
+        const auto start = std::chrono::steady_clock::now();
+
+#pragma omp parallel num_threads(threads) default(none) shared(name) reduction(+:sink)
+        {
+#ifdef BOIDS_X86
+            if (name == "avx512")
+                sink += fma_chains_avx512(FMA_ITERATIONS);
+            else if (name == "avx2_fma")
+                sink += fma_chains_avx2(FMA_ITERATIONS);
+            else if (name == "sse42")
+                sink += fma_chains_sse(FMA_ITERATIONS);
+            else
+#endif
+                sink += fma_chains_generic(FMA_ITERATIONS);
+        }
+
+        const double s = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        best = std::max(best, 2.0 * FMA_CHAINS * isa.lanes * FMA_ITERATIONS * threads / s / 1e9);
+    }
+
+    volatile float keep = sink; // the chains must not be optimized away
+    (void)keep;
+    return {isa.name, best};
+}
+
+// The triad on [first, last), vectorized with the same ISA as the peak
+#ifdef BOIDS_X86
+__attribute__((target("avx512f")))
+inline void triad_avx512(float* a, const float* b, const float* c, float s, long long first, long long last) {
+#pragma omp simd
+    for (long long i = first; i < last; i++)
+        a[i] = b[i] + s * c[i];
+}
+
+__attribute__((target("avx2,fma")))
+inline void triad_avx2(float* a, const float* b, const float* c, float s, long long first, long long last) {
+#pragma omp simd
+    for (long long i = first; i < last; i++)
+        a[i] = b[i] + s * c[i];
+}
+
+__attribute__((target("sse4.2")))
+inline void triad_sse(float* a, const float* b, const float* c, float s, long long first, long long last) {
+#pragma omp simd
+    for (long long i = first; i < last; i++)
+        a[i] = b[i] + s * c[i];
+}
+#endif
+
+inline void triad_generic(float* a, const float* b, const float* c, float s, long long first, long long last) {
+#pragma omp simd
+    for (long long i = first; i < last; i++)
+        a[i] = b[i] + s * c[i];
+}
+
+/**
+ * Triad bandwidth in GB/s with three arrays of total_bytes / 3 bytes, first-touched by the thread
+ * that sweeps them. Small working sets are swept many times per timing, so every timing moves at
+ * least 256 MB.
+ **/
+inline double stream_triad(size_t total_bytes, int threads, int reps) {
+    const long long n = std::max<long long>(1024, (long long)(total_bytes / (3 * sizeof(float))));
+    float* a = static_cast<float*>(std::aligned_alloc(64, ((n * sizeof(float) + 63) / 64) * 64));
+    float* b = static_cast<float*>(std::aligned_alloc(64, ((n * sizeof(float) + 63) / 64) * 64));
+    float* c = static_cast<float*>(std::aligned_alloc(64, ((n * sizeof(float) + 63) / 64) * 64));
+    if (!a || !b || !c) {
+        std::cerr << "Allocation of the stream arrays failed!" << std::endl;
+        exit(EXIT_FAILURE);
+    }
+
+    using Triad = void (*)(float*, const float*, const float*, float, long long, long long);
+    const std::string isa = widest_isa().name;
+    Triad triad = triad_generic;
+#ifdef BOIDS_X86
+    if (isa == "avx512")
+        triad = triad_avx512;
+    else if (isa == "avx2_fma")
+        triad = triad_avx2;
+    else if (isa == "sse42")
+        triad = triad_sse;
+#endif
+
+    // Every thread owns a contiguous range, touched first and then swept without barriers
+    const long long chunk = (n + threads - 1) / threads;
+
+#pragma omp parallel num_threads(threads) default(none) shared(a, b, c, n, chunk)
+    {
+        const long long first = std::min(n, omp_get_thread_num() * chunk);
+        const long long last = std::min(n, first + chunk);
+        for (long long i = first; i < last; i++) {
+            a[i] = 0.0f;
+            b[i] = 1.0f;
+            c[i] = 2.0f;
+        }
+    }
+
+    const double bytes = 3.0 * sizeof(float) * n;
+    const int sweeps = std::max(1, (int)(256e6 / bytes));
+    const float s = 3.0f;
+
+    double best = 0.0;
+    for (int r = 0; r < reps; r++) {
+        const auto start = std::chrono::steady_clock::now();
+
+#pragma omp parallel num_threads(threads) default(none) shared(a, b, c, n, chunk, sweeps, s, triad)
+        {
+            const long long first = std::min(n, omp_get_thread_num() * chunk);
+            const long long last = std::min(n, first + chunk);
+            for (int k = 0; k < sweeps; k++)
+                triad(a, b, c, s, first, last);
+        }
+
+        const double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        best = std::max(best, bytes * sweeps / seconds / 1e9);
+    }
+
+    std::free(a);
+    std::free(b);
+    std::free(c);
+    return best;
+}
@@ -4,77 +4,97 @@
 
 #pragma once //to include the file only once
 
-
-#include <string>
-#include <iostream>
-#include <memory>
-#include <SFML/Graphics.hpp>
-
-struct Config {
-
-    int N = 1000;
-    int frames = 300;
-    int threads = 8;
-    std::string csv;
-
-
-    //Parsing params passed via command line
-    void parse(int argc, char* argv[]) {
-        for (int i = 1; i < argc; ++i) { //i = 1 because for i=0 we always have the exe path
-            std::string arg = argv[i];
-            if (arg == "--N" && i + 1 < argc) {
-                N = std::stoi(argv[++i]);
-            } else if (arg == "--frames" && i + 1 < argc) {
-                frames = std::stoi(argv[++i]);
-            }else if (arg == "--threads" && i + 1 < argc) {
-                threads = std::stoi(argv[++i]);
-            }else if (arg == "--csv" && i + 1 < argc) {
-                csv = argv[++i];
-            }
-            else {
-                std::cerr << "Unknown argument: " << arg << std::endl;
-            }
-        }
-    }
-
-    void print() const {
-        std::cout << "Config: N=" << N
-                  << ", frames=" << frames
-                  << ", threads=" << threads
-                  << std::endl;
-    }
-};
+/**
+ * Structure Of Arrays layout, used by the SOA version.
+ * The number of dimensions D is a template parameter of the layout: in 3D the boids have two more
+ * arrays, z and vz, and the engine adds their terms at compile time (see Boids_engine.h).
+ **/
 
 //Shape separated from Boid to better parallelize
 struct Boids {
     float *x, *y;
     float *vx, *vy;
+    float *z = nullptr, *vz = nullptr; // only in 3D
 };
 
-inline Boids boids_allocation(int N) {
+inline Boids boids_allocation(int N, int dims = 2) {
     Boids boids;
 
     boids.x  = new float[N];
     boids.y  = new float[N];
     boids.vx = new float[N];
     boids.vy = new float[N];
+    if (dims == 3) {
+        boids.z  = new float[N];
+        boids.vz = new float[N];
+    }
 
     return boids;
 
 }
-float random_float(float min, float max);
-
-void print_boids(const Boids& boids, int N,
-                 std::vector<std::unique_ptr<sf::CircleShape>>& shapes,
-                 sf::RenderWindow& window);
-
-void append_csv(const std::string& filename,
-                int N, int frames, int threads,
-                long long time_ms);
 
 inline void free_boids(Boids& boids) {
     delete [] boids.x;
     delete [] boids.y;
     delete [] boids.vx;
     delete [] boids.vy;
-}
\ No newline at end of file
+    delete [] boids.z;
+    delete [] boids.vz;
+}
+
+// Layout policy for the engine (see Boids_engine.h), in DIMS dimensions
+template<int DIMS>
+struct SoaLayoutND {
+    static_assert(DIMS == 2 || DIMS == 3, "flocks are 2D or 3D");
+    static constexpr const char* NAME = DIMS == 3 ? "SOA_3D" : "SOA";
+    static constexpr int D = DIMS;
+    using Storage = Boids;
+    static constexpr bool CONTIGUOUS = true; // one contiguous array per field
+
+    static Storage allocate(int N) { return boids_allocation(N, D); }
+    static void release(Storage& b) { free_boids(b); }
+
+    static float x(const Storage& b, int i)  { return b.x[i]; }
+    static float y(const Storage& b, int i)  { return b.y[i]; }
+    static float z(const Storage& b, int i)  { return b.z[i]; }
+    static float vx(const Storage& b, int i) { return b.vx[i]; }
+    static float vy(const Storage& b, int i) { return b.vy[i]; }
+    static float vz(const Storage& b, int i) { return b.vz[i]; }
+    static const void* address(const Storage& b, int i) { return &b.x[i]; } // for the NUMA placement report
+
+    // In 3D a boid stored with the 2D call lies on the z = 0 plane, at rest along z
+    static void store(Storage& b, int i, float x, float y, float vx, float vy) {
+        b.x[i] = x;
+        b.y[i] = y;
+        b.vx[i] = vx;
+        b.vy[i] = vy;
+        if constexpr (D == 3) {
+            b.z[i] = 0.0f;
+            b.vz[i] = 0.0f;
+        }
+    }
+
+    static void store(Storage& b, int i, float x, float y, float z, float vx, float vy, float vz) {
+        static_assert(D == 3);
+        b.x[i] = x;
+        b.y[i] = y;
+        b.z[i] = z;
+        b.vx[i] = vx;
+        b.vy[i] = vy;
+        b.vz[i] = vz;
+    }
+
+    // Boid s of src into slot d of dst, every dimension (grid binning and reordering)
+    static void copy(Storage& dst, int d, const Storage& src, int s) {
+        dst.x[d] = src.x[s];
+        dst.y[d] = src.y[s];
+        dst.vx[d] = src.vx[s];
+        dst.vy[d] = src.vy[s];
+        if constexpr (D == 3) {
+            dst.z[d] = src.z[s];
+            dst.vz[d] = src.vz[s];
+        }
+    }
+};
+
+using SoaLayout = SoaLayoutND<2>;
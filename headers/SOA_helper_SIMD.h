@@ -1,78 +1,66 @@
-
 //
 // Created by giacomo on 05/12/25.
 //
 
 #pragma once
 
-#include <string>
+#include "SOA_helper.h"
+
 #include <iostream>
-#include <memory>
-#include <vector>
-#include <SFML/Graphics.hpp>
 #include <cstdlib>
 
 /**
  * This helper provides the Structure of Arrays (SOA) layout with aligned memory allocation.
  * Alignment (32 bytes) is required for more efficient SIMD (AVX) processing.
+ * As SoaLayoutND, the number of dimensions is a template parameter (z and vz arrays in 3D).
  **/
 
-struct Config {
-
-    int N = 1500;
-    int frames = 300;
-    int threads = 8;
-    std::string csv;
+// Aligned allocation ensures the starting address of each array is a multiple of 32 bytes.
+inline Boids allocate_aligned_boids(int N, int dims = 2) {
+    Boids boids;
+    const size_t ALIGNMENT = 32;
+    size_t size = N * sizeof(float);
 
-    //Parsing params passed via command line
-    void parse(int argc, char* argv[]) {
-        for (int i = 1; i < argc; ++i) {
-            std::string arg = argv[i];
-            if (arg == "--N" && i + 1 < argc) {
-                N = std::stoi(argv[++i]);
-            } else if (arg == "--frames" && i + 1 < argc) {
-                frames = std::stoi(argv[++i]);
-            } else if (arg == "--threads" && i + 1 < argc) {
-                threads = std::stoi(argv[++i]);
-            }else if (arg == "--csv" && i + 1 < argc) {
-                csv = argv[++i];
-            }
-            else {
-                std::cerr << "Unknown argument: " << arg << std::endl;
-            }
-        }
+    // Padding: size passed to aligned_alloc must be a multiple of alignment
+    if (size % ALIGNMENT != 0) {
+        size += ALIGNMENT - (size % ALIGNMENT);
     }
 
-    void print() const {
-        std::cout << "Config: N=" << N
-                  << ", frames=" << frames
-                  << ", threads=" << threads
-                  << std::endl;
-    }
-};
 
+    boids.x  = static_cast<float*>(std::aligned_alloc(ALIGNMENT, size));
+    boids.y  = static_cast<float*>(std::aligned_alloc(ALIGNMENT, size));
+    boids.vx = static_cast<float*>(std::aligned_alloc(ALIGNMENT, size));
+    boids.vy = static_cast<float*>(std::aligned_alloc(ALIGNMENT, size));
+    if (dims == 3) {
+        boids.z  = static_cast<float*>(std::aligned_alloc(ALIGNMENT, size));
+        boids.vz = static_cast<float*>(std::aligned_alloc(ALIGNMENT, size));
+    }
 
-struct Boids {
-    float *x, *y;
-    float *vx, *vy;
-};
+    if (!boids.x || !boids.y || !boids.vx || !boids.vy || (dims == 3 && (!boids.z || !boids.vz))) {
+        std::cerr << "Aligned allocation failed!" << std::endl;
+        exit(EXIT_FAILURE);
+    }
 
-// Aligned allocation ensures the starting address of each array is a multiple of 32 bytes.
-inline Boids allocate_aligned_boids(int N);
+    return boids;
+}
 
 inline void free_boids_aligned(Boids& boids) {
     std::free(boids.x);
     std::free(boids.y);
     std::free(boids.vx);
     std::free(boids.vy);
+    std::free(boids.z);
+    std::free(boids.vz);
 }
 
-float random_float(float min, float max);
+// Layout policy for the engine (see Boids_engine.h): the accessors of SoaLayoutND, aligned arrays
+template<int DIMS>
+struct AlignedSoaLayoutND : SoaLayoutND<DIMS> {
+    static constexpr const char* NAME = DIMS == 3 ? "SOA_aligned_3D" : "SOA_aligned";
 
-void print_boids(const Boids& boids, int N,
-                 std::vector<std::unique_ptr<sf::CircleShape>>& shapes,
-                 sf::RenderWindow& window);
+    static Boids allocate(int N) { return allocate_aligned_boids(N, DIMS); }
+    static void release(Boids& b) { free_boids_aligned(b); }
+};
 
-void append_csv(const std::string& filename,
-                int N, int frames, int threads,
-                long long time_ms);
\ No newline at end of file
+using AlignedSoaLayout = AlignedSoaLayoutND<2>;
+using AlignedSoaLayout3D = AlignedSoaLayoutND<3>;
@@ -0,0 +1,275 @@
+//
+// Created by giacomo on 07/02/26.
+//
+
+#pragma once //to include the file only once
+
+#include "Boids_engine.h"
+#include "Drift.h"
+#include "Frame_stats.h"
+#include "Render_pipeline.h"
+#include "Snapshot.h"
+#include "Trajectory_writer.h"
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <optional>
+#include <string>
+#include <thread>
+#include <type_traits>
+#include <vector>
+#include <omp.h>
+#include <SFML/Graphics.hpp>
+
+/**
+ * Frame loop of the executables: graphics with SFML (or headless), time measurement and csv.
+ **/
+
+// Same triangle as sf::CircleShape(3.f, 3), relative to the position of the boid
+constexpr float BOID_RADIUS = 3.0f;
+const sf::Vector2f BOID_TRIANGLE[3] = {
+    {BOID_RADIUS, 0.0f},
+    {BOID_RADIUS + BOID_RADIUS * 0.8660254f, BOID_RADIUS * 1.5f},
+    {BOID_RADIUS - BOID_RADIUS * 0.8660254f, BOID_RADIUS * 1.5f},
+};
+
+/**
+ * All the boids are drawn with one vertex array of triangles and a single draw call.
+ * The vertices are filled in parallel straight from the positions of the layout, boid i always in
+ * the same vertices even if the storage was reordered. A 3D flock is drawn as its x-y projection.
+ **/
+template<class Layout>
+inline void print_boids(const typename Layout::Storage& boids, const int* slot_of, int N,
+                        sf::VertexArray& vertices,
+                        sf::RenderWindow& window)
+{
+#pragma omp parallel for schedule(static)
+    for (int i = 0; i < N; ++i) {
+        const sf::Vector2f position{Layout::x(boids, slot_of[i]), Layout::y(boids, slot_of[i])};
+        for (int k = 0; k < 3; k++)
+            vertices[3 * i + k].position = {position.x + BOID_TRIANGLE[k].x, position.y + BOID_TRIANGLE[k].y};
+    }
+
+    window.draw(vertices);
+}
+
+/**
+ * Whole run of a version: initialization, frame loop with graphics (or headless) and csv.
+ * The measurements, to ensure a fair comparison, are done only on the "core" of boids simulation.
+ **/
+template<class Layout, class Exec>
+inline int run_simulation(Config cfg) {
+    // Parameters of the model: the compiled set when they are its values, otherwise the runtime fallback
+    if constexpr (std::is_same_v<typename Exec::Parameters, Params>) {
+        load_flock_params(cfg.params, cfg.param);
+        print_params();
+        if (!params_are_compiled())
+            return run_simulation<Layout, WithParams<Exec, RuntimeParams>>(cfg);
+    }
+
+    // A restored flock brings its own N and frame index
+    SnapshotView restored;
+    long long first_frame = 0;
+    if (Layout::D == 3 && !cfg.restore.empty()) {
+        std::cerr << "Snapshots are 2D, a 3D flock can't be restored from " << cfg.restore << std::endl;
+        exit(EXIT_FAILURE);
+    }
+    if (!cfg.restore.empty()) {
+        restored = map_snapshot(cfg.restore);
+        cfg.N = (int)restored.header->N;
+        first_frame = (long long)restored.header->frame;
+        std::cout << "Restored " << cfg.N << " boids at frame " << first_frame << " from " << cfg.restore << "\n";
+    }
+
+    const int N = cfg.N;
+    const int FRAMES = cfg.frames;
+
+    if (cfg.neighbours != "all" && cfg.neighbours != "grid" && cfg.neighbours != "verlet") {
+        std::cerr << "Unknown neighbours search: " << cfg.neighbours << std::endl;
+        exit(EXIT_FAILURE);
+    }
+
+    parse_schedule(cfg.schedule); // exits on an unknown schedule, before any allocation
+
+    if (cfg.neighbours == "verlet" && cfg.skin <= 0.0f) {
+        std::cerr << "The skin of the Verlet lists must be positive" << std::endl;
+        exit(EXIT_FAILURE);
+    }
+    if (cfg.neighbours == "verlet" && cfg.symmetric)
+        std::cerr << "Warning: --symmetric doesn't apply to the Verlet lists, ignored" << std::endl;
+
+    if (cfg.storage != "fp32" && !HasReference<Layout>) {
+        std::cerr << "Storage " << cfg.storage << " is not available for this version" << std::endl;
+        exit(EXIT_FAILURE);
+    }
+
+    // Snapshots and trajectories hold x, y, vx, vy only
+    if (Layout::D == 3 && (!cfg.snapshot.empty() || !cfg.trajectory.empty())) {
+        std::cerr << "Warning: snapshots and trajectories are 2D, --snapshot and --trajectory ignored" << std::endl;
+        cfg.snapshot.clear();
+        cfg.trajectory.clear();
+    }
+
+    omp_set_num_threads(cfg.threads);
+    std::cout << "Threads set: " << cfg.threads << "\n";
+    pin_threads(cfg.affinity); // before the allocation, the pages follow the threads
+
+#ifdef _OPENMP
+    std::cout << "OPEN_MP working" << "\n";
+#endif
+
+    Simulation<Layout> sim = allocate_simulation<Layout, Exec>(cfg);
+    if (restored.mapping) {
+        restore_boids<Layout>(sim.boids, restored);
+        unmap_snapshot(restored);
+    } else {
+        const uint64_t seed = run_seed(cfg);
+        init_boids<Layout, typename Exec::Parameters>(sim, seed);
+        std::cout << "Seed: " << seed << "\n";
+    }
+    // The 3D runs are told apart in the csv by the kernel column
+    const std::string kernel_name = std::string(Layout::D == 3 ? "3d_" : "") + sim.kernel.name;
+    std::cout << "Kernel: " << kernel_name << "\n";
+    if constexpr (Exec::SIMD)
+        std::cout << "SIMD loops: " << loop_isa_name() << "\n"; // the omp simd loops, see run_simd_loop()
+    std::cout << "Storage: " << Layout::NAME << "\n";
+    report_placement<Layout>(sim.boids, N, "the boids");
+
+    DriftTracker<Layout, Exec> drift;
+    drift.start(cfg, sim);
+    if (sim.block > 0)
+        std::cout << "Block: " << sim.block << " boids (" << sim.block * 2 * Layout::D * sizeof(float) / 1024.0 << " KiB per tile)\n";
+    else if (cfg.block != 0)
+        std::cerr << "Warning: --block only applies to the all-pairs search without --symmetric" << std::endl;
+    if ((sim.symmetric || sim.block > 0) && cfg.schedule != "static")
+        std::cerr << "Warning: --schedule " << cfg.schedule << " doesn't apply with --symmetric or --block, static used" << std::endl;
+
+    // Three vertices per boid, none in headless mode
+    sf::VertexArray vertices(sf::PrimitiveType::Triangles, cfg.headless ? 0 : 3 * (size_t)N);
+
+    // In headless mode there is no window and no frame rate limit: frames run as fast as the kernel
+    std::optional<sf::RenderWindow> window;
+    if (!cfg.headless) {
+        window.emplace(sf::VideoMode({(unsigned)RuntimeParams::X_SIZE, (unsigned)RuntimeParams::Y_SIZE}), "Boids simulation");
+        window->setFramerateLimit(60); // call it once after creating the window
+    }
+
+    if (cfg.pipeline && cfg.headless)
+        std::cerr << "Warning: --pipeline has no effect in headless mode" << std::endl;
+    const bool pipelined = cfg.pipeline && !cfg.headless;
+
+    // Pipelined mode: the OpenGL context moves to the render thread, this thread keeps the events
+    RenderPipeline pipeline;
+    std::thread renderer;
+    if (pipelined) {
+        allocate_pipeline(pipeline, N);
+        (void)window->setActive(false);
+        renderer = std::thread(render_loop, std::ref(pipeline), std::ref(*window), BOID_TRIANGLE, N);
+        unpin_thread(renderer); // not on the cpu of OpenMP thread 0, see Numa.h
+    }
+
+    PerfCounters counters;
+    if (cfg.counters)
+        open_perf_counters(counters, cfg.threads);
+
+    TrajectoryWriter trajectory;
+    if (!cfg.trajectory.empty()) {
+        open_trajectory(trajectory, cfg.trajectory, N, cfg.trajectory_every);
+        unpin_thread(trajectory.thread);
+    }
+
+    int iterations = 0;
+    bool closed = false;
+    FrameStats stats = allocate_frame_stats(FRAMES);
+    const auto wall_start = std::chrono::steady_clock::now();
+
+    while ((cfg.headless || !closed) && iterations < FRAMES) {
+        if (!cfg.headless) {
+            if (!pipelined)
+                window->clear(sf::Color::Black);
+            while (const std::optional event = window->pollEvent()) {
+                if (event->is<sf::Event::Closed>())
+                    closed = true; // the window is closed after the loop, when nobody draws in it
+            }
+        }
+
+        // without counting the graphic, pure boids performance (steady_clock is monotonic)
+        const auto start = std::chrono::steady_clock::now();
+
+        enable_perf_counters(counters);
+        step<Layout, Exec>(sim);
+        disable_perf_counters(counters);
+
+        iterations++;
+        reorder_if_due(sim, iterations); // part of the simulation cost, so inside the measurement
+
+        const auto end = std::chrono::steady_clock::now();
+        record_frame(stats, std::chrono::duration_cast<std::chrono::nanoseconds>(end - start).count());
+
+        // Reference fp32 flock of --drift, outside the measurement too
+        drift.after_step(sim, iterations);
+
+        // Recorded frames handed to the writer thread, outside the measurement too
+        push_trajectory_frame<Layout>(trajectory, sim.boids, sim.slot_of.data(), first_frame + iterations);
+
+        // Periodic snapshot, outside the measurement too
+        if (!cfg.snapshot.empty() && cfg.snapshot_every > 0 && iterations % cfg.snapshot_every == 0)
+            write_snapshot<Layout>(cfg.snapshot, sim.boids, sim.slot_of.data(), N, first_frame + iterations);
+
+        //Graphical part outside the measurement: drawn here, or handed to the render thread
+
+        if (pipelined) {
+            publish_frame<Layout>(pipeline, sim.boids, sim.slot_of.data(), N, first_frame + iterations);
+        } else if (!cfg.headless) {
+            print_boids<Layout>(sim.boids, sim.slot_of.data(), N, vertices, *window);
+            window->display();
+        }
+    }
+
+    const auto wall_end = std::chrono::steady_clock::now();
+    close_trajectory(trajectory);
+
+    if (pipelined) {
+        stop_pipeline(pipeline);
+        renderer.join();
+        std::cout << "Rendered " << pipeline.drawn.load() << " of " << iterations << " frames\n";
+    }
+    if (window)
+        window->close();
+
+    if (!cfg.snapshot.empty())
+        write_snapshot<Layout>(cfg.snapshot, sim.boids, sim.slot_of.data(), N, first_frame + iterations);
+
+    const LatencySummary latency = summarize_frames(stats);
+    const CounterTotals counter_totals = close_perf_counters(counters);
+    drift.finish();
+
+    append_csv(cfg.csv,
+               cfg.N,
+               cfg.frames,
+               cfg.threads,
+               kernel_name,
+               latency,
+               sim.block,
+               counter_totals);
+    append_latency_json(cfg.csv, cfg.N, cfg.frames, cfg.threads, kernel_name, latency);
+
+    printf("Frame %d duration: %.3f milliseconds\n", iterations, latency.total_ns / 1e6);
+    print_latency(latency, iterations);
+    print_busy(sim.busy_ns);
+    print_perf_counters(counter_totals, iterations, N);
+    if (sim.reordering.every > 0)
+        printf("Reordered along the %s curve %d times\n", sim.reordering.hilbert ? "Hilbert" : "Morton", sim.reordering.passes);
+    if (sim.use_verlet)
+        print_verlet(sim.verlet, N);
+    if (iterations > 0)
+        printf("Wall clock per frame, graphics included: %.3f milliseconds\n",
+               std::chrono::duration<double, std::milli>(wall_end - wall_start).count() / iterations);
+
+    free_simulation(sim);
+
+    return 0;
+}
@@ -0,0 +1,202 @@
+//
+// Created by giacomo on 11/02/26.
+//
+
+#pragma once //to include the file only once
+
+#include "Boids_engine.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <vector>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+/**
+ * Binary snapshot of a flock, to restart large runs without the random initialization and the
+ * warm-up to a steady flocking state.
+ * File format (version 1, little endian as the machine writing it):
+ *  - SnapshotHeader: magic, version, N, frame index and the simulation parameters;
+ *  - payload at payload_offset (multiple of 32): the x, y, vx, vy arrays, one after the other,
+ *    each padded to array_stride bytes (multiple of 32), so every array is 32-byte aligned in the
+ *    mapping as in the aligned layouts.
+ * The payload is always SOA, so a snapshot written by a layout can be restored by any other one.
+ * Restoring maps the file with mmap and copies the arrays into the storage of the layout in parallel.
+ **/
+
+constexpr char SNAPSHOT_MAGIC[8] = {'B', 'O', 'I', 'D', 'S', 'N', 'A', 'P'};
+constexpr uint32_t SNAPSHOT_VERSION = 1;
+constexpr uint64_t SNAPSHOT_ALIGNMENT = 32;
+
+struct SnapshotHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t header_size;
+    uint64_t N;
+    uint64_t frame;
+    uint64_t array_stride;   // bytes of every array, padding included
+    uint64_t payload_offset; // from the beginning of the file
+
+    // Parameters of the run that wrote the snapshot
+    float turn_factor, visual_range, protected_range;
+    float centering_factor, avoid_factor, matching_factor;
+    float max_speed, min_speed;
+    float top_margin, bot_margin, left_margin, right_margin, margin;
+};
+
+// A snapshot mapped in memory, valid until unmap_snapshot()
+struct SnapshotView {
+    const SnapshotHeader* header = nullptr;
+    const float* x = nullptr;
+    const float* y = nullptr;
+    const float* vx = nullptr;
+    const float* vy = nullptr;
+    void* mapping = nullptr;
+    size_t size = 0;
+};
+
+inline uint64_t snapshot_round_up(uint64_t bytes) {
+    return (bytes + SNAPSHOT_ALIGNMENT - 1) / SNAPSHOT_ALIGNMENT * SNAPSHOT_ALIGNMENT;
+}
+
+// The parameters recorded are the ones of the run (see Flock_params.h)
+inline SnapshotHeader make_snapshot_header(int N, long long frame) {
+    using P = RuntimeParams;
+    SnapshotHeader h{};
+    std::memcpy(h.magic, SNAPSHOT_MAGIC, sizeof(h.magic));
+    h.version = SNAPSHOT_VERSION;
+    h.header_size = sizeof(SnapshotHeader);
+    h.N = N;
+    h.frame = frame;
+    h.array_stride = snapshot_round_up((uint64_t)N * sizeof(float));
+    h.payload_offset = snapshot_round_up(sizeof(SnapshotHeader));
+
+    h.turn_factor = P::TURN_FACTOR;
+    h.visual_range = P::VISUAL_RANGE;
+    h.protected_range = P::PROTECTED_RANGE;
+    h.centering_factor = P::CENTERING_FACTOR;
+    h.avoid_factor = P::AVOID_FACTOR;
+    h.matching_factor = P::MATCHING_FACTOR;
+    h.max_speed = P::MAX_SPEED;
+    h.min_speed = P::MIN_SPEED;
+    h.top_margin = P::TOP_MARGIN;
+    h.bot_margin = P::BOT_MARGIN;
+    h.left_margin = P::LEFT_MARGIN;
+    h.right_margin = P::RIGHT_MARGIN;
+    h.margin = P::MARGIN;
+    return h;
+}
+
+/**
+ * Writes the current boids at frame `frame`. The file is written next to the destination and then
+ * renamed, so a crash while writing never leaves a truncated snapshot in place of the last good one.
+ **/
+template<class Layout>
+inline void write_snapshot(const std::string& path, const typename Layout::Storage& boids, const int* slot_of,
+                           int N, long long frame) {
+    const SnapshotHeader h = make_snapshot_header(N, frame);
+    const std::string tmp_path = path + ".tmp";
+
+    std::ofstream out(tmp_path, std::ios::binary | std::ios::trunc);
+    if (!out) {
+        std::cerr << "Cannot write snapshot " << tmp_path << std::endl;
+        exit(EXIT_FAILURE);
+    }
+
+    std::vector<char> zeros(SNAPSHOT_ALIGNMENT, 0);
+    out.write(reinterpret_cast<const char*>(&h), sizeof(h));
+    out.write(zeros.data(), h.payload_offset - sizeof(h));
+
+    // One field at a time through the getters of the layout, so every layout writes the same SOA payload.
+    // Boids in identity order (slot_of), whatever the order of the storage is
+    std::vector<float> field(N);
+    for (int f = 0; f < 4; f++) {
+#pragma omp parallel for schedule(static)
+        for (int i = 0; i < N; i++) {
+            const int slot = slot_of[i];
+            field[i] = f == 0 ? Layout::x(boids, slot)
+                     : f == 1 ? Layout::y(boids, slot)
+                     : f == 2 ? Layout::vx(boids, slot)
+                              : Layout::vy(boids, slot);
+        }
+        out.write(reinterpret_cast<const char*>(field.data()), (std::streamsize)N * sizeof(float));
+        out.write(zeros.data(), h.array_stride - (uint64_t)N * sizeof(float));
+    }
+
+    out.close();
+    if (!out || std::rename(tmp_path.c_str(), path.c_str()) != 0) {
+        std::cerr << "Cannot write snapshot " << path << std::endl;
+        exit(EXIT_FAILURE);
+    }
+}
+
+inline SnapshotView map_snapshot(const std::string& path) {
+    SnapshotView view;
+
+    const int fd = open(path.c_str(), O_RDONLY);
+    struct stat st{};
+    if (fd < 0 || fstat(fd, &st) != 0) {
+        std::cerr << "Cannot open snapshot " << path << std::endl;
+        exit(EXIT_FAILURE);
+    }
+
+    view.size = (size_t)st.st_size;
+    if (view.size >= sizeof(SnapshotHeader))
+        view.mapping = mmap(nullptr, view.size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd); // the mapping stays valid
+
+    if (view.mapping == nullptr || view.mapping == MAP_FAILED) {
+        std::cerr << "Cannot map snapshot " << path << std::endl;
+        exit(EXIT_FAILURE);
+    }
+
+    const auto* h = static_cast<const SnapshotHeader*>(view.mapping);
+    const bool valid = std::memcmp(h->magic, SNAPSHOT_MAGIC, sizeof(h->magic)) == 0
+                       && h->version == SNAPSHOT_VERSION
+                       && h->header_size == sizeof(SnapshotHeader)
+                       && h->payload_offset % SNAPSHOT_ALIGNMENT == 0
+                       && h->array_stride >= h->N * sizeof(float)
+                       && h->payload_offset + 4 * h->array_stride <= view.size;
+    if (!valid) {
+        std::cerr << "Invalid or unsupported snapshot " << path << std::endl;
+        exit(EXIT_FAILURE);
+    }
+
+    const SnapshotHeader ref = make_snapshot_header((int)h->N, 0);
+    const size_t params_size = offsetof(SnapshotHeader, margin) + sizeof(float) - offsetof(SnapshotHeader, turn_factor);
+    if (std::memcmp(&h->turn_factor, &ref.turn_factor, params_size) != 0)
+        std::cerr << "Warning: snapshot " << path << " was written with different parameters" << std::endl;
+
+    const char* payload = static_cast<const char*>(view.mapping) + h->payload_offset;
+    view.header = h;
+    view.x  = reinterpret_cast<const float*>(payload);
+    view.y  = reinterpret_cast<const float*>(payload + h->array_stride);
+    view.vx = reinterpret_cast<const float*>(payload + 2 * h->array_stride);
+    view.vy = reinterpret_cast<const float*>(payload + 3 * h->array_stride);
+
+    return view;
+}
+
+inline void unmap_snapshot(SnapshotView& view) {
+    if (view.mapping)
+        munmap(view.mapping, view.size);
+    view = SnapshotView{};
+}
+
+// Copies the mapped boids into the storage, the pages are faulted in by the threads that use them
+template<class Layout>
+inline void restore_boids(typename Layout::Storage& boids, const SnapshotView& view) {
+    const int N = (int)view.header->N;
+
+#pragma omp parallel for schedule(static)
+    for (int i = 0; i < N; i++)
+        Layout::store(boids, i, view.x[i], view.y[i], view.vx[i], view.vy[i]);
+}
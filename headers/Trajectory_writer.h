@@ -0,0 +1,271 @@
+//
+// Created by giacomo on 21/02/26.
+//
+
+#pragma once //to include the file only once
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <condition_variable>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include <omp.h>
+
+#ifdef BOIDS_ZLIB
+#include <zlib.h>
+#endif
+
+/**
+ * Trajectory output (--trajectory <file>, --trajectory-every k) written by a background thread.
+ * The frame loop only copies the positions and velocities of the recorded frames (in parallel, in
+ * identity order) into a free slot of a ring buffer; the writer thread takes the slots in order and:
+ *  - quantizes them (positions in 1/64 px, velocities in 1/1024);
+ *  - encodes every value as the difference from the previous recorded frame (every KEYFRAME_EVERY
+ *    records a keyframe with the absolute values, to start decoding from there), zigzag + varint;
+ *  - compresses the block of the frame with zlib (BOIDS_ZLIB, set by CMake when zlib is found),
+ *    otherwise the varint block is stored as it is.
+ * When the ring is full the frame loop waits for the writer: no frame is lost, and the time waited
+ * (back-pressure) is reported with the queue depth and the compression ratio at the end of the run.
+ * File format (little endian), read by scripts/read_trajectory.py:
+ *  - TrajectoryHeader;
+ *  - one block per recorded frame: TrajectoryBlock, then stored_size bytes. The raw block is the
+ *    varints of x of every boid, then y, vx, vy (one field after the other compresses better).
+ **/
+
+constexpr char TRAJECTORY_MAGIC[8] = {'B', 'O', 'I', 'D', 'T', 'R', 'A', 'J'};
+constexpr uint32_t TRAJECTORY_VERSION = 1;
+constexpr float TRAJECTORY_POS_SCALE = 64.0f;
+constexpr float TRAJECTORY_VEL_SCALE = 1024.0f;
+constexpr int KEYFRAME_EVERY = 64;
+constexpr int TRAJECTORY_SLOTS = 8;
+
+struct TrajectoryHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t header_size;
+    uint64_t N;
+    uint32_t every;
+    uint32_t keyframe_every;
+    float pos_scale;
+    float vel_scale;
+};
+
+struct TrajectoryBlock {
+    uint64_t frame;
+    uint32_t raw_size;
+    uint32_t stored_size;
+    uint8_t keyframe;
+    uint8_t compressed; // 1 = zlib, 0 = raw varints
+    uint8_t pad[6];
+};
+
+struct TrajectorySlot {
+    std::vector<float> data; // x of every boid, then y, vx, vy
+    long long frame = 0;
+};
+
+struct TrajectoryWriter {
+    bool active = false;
+    int N = 0;
+    int every = 1;
+    std::ofstream out;
+
+    // Ring buffer: slots [head, head + count) are full, in frame order
+    TrajectorySlot slots[TRAJECTORY_SLOTS];
+    int head = 0;
+    int count = 0;
+    bool closing = false;
+    std::mutex mutex;
+    std::condition_variable not_full, not_empty;
+    std::thread thread;
+
+    // Writer state
+    std::vector<int32_t> previous; // quantized values of the last recorded frame
+    std::vector<uint8_t> raw, stored;
+    long long records = 0;
+
+    // Back-pressure and output statistics
+    long long pushed = 0;
+    long long waits = 0;       // frames that found the ring full
+    long long wait_ns = 0;     // time the frame loop spent waiting for a free slot
+    int max_depth = 0;
+    long long raw_bytes = 0;
+    long long stored_bytes = 0;
+    long long writer_busy_ns = 0;
+};
+
+inline uint32_t zigzag(int32_t v) {
+    return ((uint32_t)v << 1) ^ (uint32_t)(v >> 31);
+}
+
+inline void put_varint(std::vector<uint8_t>& bytes, uint32_t v) {
+    while (v >= 0x80) {
+        bytes.push_back((uint8_t)(v | 0x80));
+        v >>= 7;
+    }
+    bytes.push_back((uint8_t)v);
+}
+
+// Delta + varint encoding of a slot and (optionally) zlib, then the block on the file
+inline void write_trajectory_block(TrajectoryWriter& w, const TrajectorySlot& slot) {
+    const int N = w.N;
+    const bool keyframe = w.records % KEYFRAME_EVERY == 0;
+
+    w.raw.clear();
+    for (int f = 0; f < 4; f++) {
+        const float scale = f < 2 ? TRAJECTORY_POS_SCALE : TRAJECTORY_VEL_SCALE;
+        for (int i = 0; i < N; i++) {
+            const size_t k = (size_t)f * N + i;
+            const int32_t q = (int32_t)std::lrint(slot.data[k] * scale);
+            put_varint(w.raw, zigzag(keyframe ? q : q - w.previous[k]));
+            w.previous[k] = q;
+        }
+    }
+
+    TrajectoryBlock block{};
+    block.frame = slot.frame;
+    block.keyframe = keyframe;
+    block.raw_size = (uint32_t)w.raw.size();
+    const uint8_t* payload = w.raw.data();
+    block.stored_size = block.raw_size;
+
+#ifdef BOIDS_ZLIB
+    uLongf size = compressBound(w.raw.size());
+    w.stored.resize(size);
+    if (compress2(w.stored.data(), &size, w.raw.data(), w.raw.size(), Z_BEST_SPEED) == Z_OK && size < w.raw.size()) {
+        block.compressed = 1;
+        block.stored_size = (uint32_t)size;
+        payload = w.stored.data();
+    }
+#endif
+
+    w.out.write(reinterpret_cast<const char*>(&block), sizeof(block));
+    w.out.write(reinterpret_cast<const char*>(payload), block.stored_size);
+
+    w.raw_bytes += block.raw_size;
+    w.stored_bytes += block.stored_size;
+    w.records++;
+}
+
+// Body of the writer thread: drains the ring until it is closed and empty
+inline void trajectory_loop(TrajectoryWriter& w) {
+    while (true) {
+        std::unique_lock<std::mutex> lock(w.mutex);
+        w.not_empty.wait(lock, [&w] { return w.count > 0 || w.closing; });
+        if (w.count == 0)
+            return;
+
+        // The slot stays full while it is written, so the frame loop can't overwrite it
+        TrajectorySlot& slot = w.slots[w.head];
+        lock.unlock();
+
+        const auto start = std::chrono::steady_clock::now();
+        write_trajectory_block(w, slot);
+        w.writer_busy_ns += std::chrono::duration_cast<std::chrono::nanoseconds>(
+                std::chrono::steady_clock::now() - start).count();
+
+        lock.lock();
+        w.head = (w.head + 1) % TRAJECTORY_SLOTS;
+        w.count--;
+        lock.unlock();
+        w.not_full.notify_one();
+    }
+}
+
+inline void open_trajectory(TrajectoryWriter& w, const std::string& path, int N, int every) {
+    w.out.open(path, std::ios::binary | std::ios::trunc);
+    if (!w.out) {
+        std::cerr << "Cannot write trajectory " << path << std::endl;
+        exit(EXIT_FAILURE);
+    }
+
+    w.active = true;
+    w.N = N;
+    w.every = std::max(every, 1);
+    for (TrajectorySlot& slot : w.slots)
+        slot.data.resize(4 * (size_t)N);
+    w.previous.assign(4 * (size_t)N, 0);
+
+    TrajectoryHeader h{};
+    std::memcpy(h.magic, TRAJECTORY_MAGIC, sizeof(h.magic));
+    h.version = TRAJECTORY_VERSION;
+    h.header_size = sizeof(TrajectoryHeader);
+    h.N = N;
+    h.every = w.every;
+    h.keyframe_every = KEYFRAME_EVERY;
+    h.pos_scale = TRAJECTORY_POS_SCALE;
+    h.vel_scale = TRAJECTORY_VEL_SCALE;
+    w.out.write(reinterpret_cast<const char*>(&h), sizeof(h));
+
+    w.thread = std::thread(trajectory_loop, std::ref(w));
+}
+
+/**
+ * Frame loop side: waits for a free slot (back-pressure), fills it with the OpenMP team and hands it
+ * to the writer. Only the copy and the wait are paid by the simulation.
+ **/
+template<class Layout>
+inline void push_trajectory_frame(TrajectoryWriter& w, const typename Layout::Storage& boids, const int* slot_of,
+                                  long long frame) {
+    if (!w.active || frame % w.every != 0)
+        return;
+
+    std::unique_lock<std::mutex> lock(w.mutex);
+    if (w.count == TRAJECTORY_SLOTS) {
+        const auto start = std::chrono::steady_clock::now();
+        w.not_full.wait(lock, [&w] { return w.count < TRAJECTORY_SLOTS; });
+        w.waits++;
+        w.wait_ns += std::chrono::duration_cast<std::chrono::nanoseconds>(
+                std::chrono::steady_clock::now() - start).count();
+    }
+    TrajectorySlot& slot = w.slots[(w.head + w.count) % TRAJECTORY_SLOTS];
+    lock.unlock();
+
+    const int N = w.N;
+    float* data = slot.data.data();
+#pragma omp parallel for schedule(static)
+    for (int i = 0; i < N; i++) {
+        const int s = slot_of[i];
+        data[i] = Layout::x(boids, s);
+        data[N + i] = Layout::y(boids, s);
+        data[2 * (size_t)N + i] = Layout::vx(boids, s);
+        data[3 * (size_t)N + i] = Layout::vy(boids, s);
+    }
+    slot.frame = frame;
+
+    lock.lock();
+    w.count++;
+    w.max_depth = std::max(w.max_depth, w.count);
+    w.pushed++;
+    lock.unlock();
+    w.not_empty.notify_one();
+}
+
+inline void close_trajectory(TrajectoryWriter& w) {
+    if (!w.active)
+        return;
+
+    {
+        std::lock_guard<std::mutex> lock(w.mutex);
+        w.closing = true;
+    }
+    w.not_empty.notify_one();
+    w.thread.join();
+    w.out.close();
+    w.active = false;
+
+    printf("Trajectory: %lld frames, %.2f MB written (%.1f%% of the varints, %.2f bytes per boid and frame)\n",
+           w.records, w.stored_bytes / 1e6, w.raw_bytes > 0 ? 100.0 * w.stored_bytes / w.raw_bytes : 0.0,
+           w.records > 0 ? (double)w.stored_bytes / ((double)w.records * w.N) : 0.0);
+    printf("Trajectory back-pressure: %lld of %lld frames waited for the writer, %.3f ms in total, max queue %d of %d, writer busy %.3f ms\n",
+           w.waits, w.pushed, w.wait_ns / 1e6, w.max_depth, TRAJECTORY_SLOTS, w.writer_busy_ns / 1e6);
+}
@@ -0,0 +1,184 @@
+//
+// Created by giacomo on 22/02/26.
+//
+
+#pragma once //to include the file only once
+
+#include "Grid.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <vector>
+#include <omp.h>
+
+/**
+ * Verlet neighbour lists (--neighbours verlet, --skin <px>).
+ * A boid moves at most MAX_SPEED = 6 px per frame and sees 40 px, so its neighbours change slowly.
+ * The lists keep, for every boid, the boids within VISUAL_RANGE + skin when they were built, in CSR:
+ * the candidates of row r are candidates[row_start[r], row_start[r + 1]), and row r belongs to the
+ * boid grid.order[r]. They are built with a grid of cells as wide as the cutoff, rows in binned order
+ * so that consecutive rows look at close boids. In 3D (Layout::D == 3) the cells and the displacement
+ * have z too.
+ * Between two builds the frame only tests the candidates of a boid (the distance test stays, the lists
+ * are a superset). They are rebuilt when a boid has moved more than skin / 2 since the last build:
+ * two boids got closer by at most skin, so no pair within VISUAL_RANGE can be missing from the lists.
+ **/
+
+template<class Layout>
+struct VerletLists {
+    float skin;
+    float cutoff;          // VISUAL_RANGE + skin
+    Grid<Layout> grid;     // only used by the builds, grid.order is the boid of every row
+
+    std::vector<int> row_start;  // N + 1 entries
+    std::vector<int> candidates; // storage indices
+    std::vector<float> x_ref, y_ref, z_ref; // positions at the last build (storage index), z only in 3D
+    std::vector<float> thread_max;   // largest squared displacement seen by every thread
+    std::vector<std::vector<int>> thread_candidates; // rows of every thread during a build
+
+    bool valid = false;    // false before the first build and after a reordering of the storage
+    bool rebuild = false;
+    long long builds = 0;
+    long long frames = 0;
+    long long candidates_built = 0; // summed over the builds, for the report
+};
+
+template<class Layout>
+inline VerletLists<Layout> allocate_verlet(int N, float visual_range, float skin, int width, int height, int depth,
+                                           int n_threads) {
+    VerletLists<Layout> lists;
+    lists.skin = skin;
+    lists.cutoff = visual_range + skin;
+    lists.grid = allocate_grid<Layout>(N, width, height, depth, lists.cutoff, n_threads);
+    lists.row_start.assign(N + 1, 0);
+    lists.x_ref.resize(N);
+    lists.y_ref.resize(N);
+    if (Layout::D == 3)
+        lists.z_ref.resize(N);
+    lists.thread_max.assign(n_threads, 0.0f);
+    lists.thread_candidates.resize(n_threads);
+    return lists;
+}
+
+template<class Layout>
+inline void free_verlet(VerletLists<Layout>& lists) {
+    free_grid(lists.grid);
+}
+
+/**
+ * Rows of the lists, in one pass over the binned boids: every thread writes the candidates of its
+ * rows (static partition, so they are contiguous) in its own buffer, without a branch on the distance
+ * test, then the buffers are concatenated at the offsets given by the scan of the row lengths.
+ * Called from inside the parallel region.
+ **/
+template<class Layout>
+inline void build_verlet(VerletLists<Layout>& lists, const typename Layout::Storage& boids, int N) {
+    Grid<Layout>& grid = lists.grid;
+    const typename Layout::Storage& b = grid.binned;
+    const float sq_cutoff = lists.cutoff * lists.cutoff;
+    const int tid = omp_get_thread_num();
+    std::vector<int>& buffer = lists.thread_candidates[tid];
+    int n = 0;
+    int first_row = N;
+
+    build_grid(grid, boids, N);
+
+#pragma omp for schedule(static)
+    for (int s = 0; s < N; s++) {
+        first_row = std::min(first_row, s);
+        const int row_first = n;
+        const float xs = Layout::x(b, s);
+        const float ys = Layout::y(b, s);
+        const float zs = layout_z<Layout>(b, s);
+
+        for_each_block_range(grid, grid_cell(grid, xs, ys, zs), [&](int first, int last) {
+            if ((size_t)(n + last - first) > buffer.size())
+                buffer.resize(2 * (size_t)(n + last - first));
+
+            // Every boid is written, only the candidates move the end forward (binned index, s excluded)
+            int* out = buffer.data();
+            for (int j = first; j < last; j++) {
+                const float dx = xs - Layout::x(b, j);
+                const float dy = ys - Layout::y(b, j);
+                float dist_sq = dx*dx + dy*dy;
+                if constexpr (Layout::D == 3) {
+                    const float dz = zs - Layout::z(b, j);
+                    dist_sq += dz*dz;
+                }
+                out[n] = j;
+                n += (dist_sq < sq_cutoff) & (j != s);
+            }
+        });
+
+        lists.row_start[s + 1] = n - row_first;
+        const int i = grid.order[s];
+        lists.x_ref[i] = xs;
+        lists.y_ref[i] = ys;
+        if constexpr (Layout::D == 3)
+            lists.z_ref[i] = zs;
+    }
+
+#pragma omp single
+    {
+        lists.row_start[0] = 0;
+        for (int s = 0; s < N; s++)
+            lists.row_start[s + 1] += lists.row_start[s];
+        lists.candidates.resize(lists.row_start[N]);
+        lists.candidates_built += lists.row_start[N];
+        lists.builds++;
+        lists.valid = true;
+    }
+
+    // Storage index of every candidate, at the place of the rows of this thread
+    if (first_row < N) {
+        int* out = lists.candidates.data() + lists.row_start[first_row];
+        for (int k = 0; k < n; k++)
+            out[k] = grid.order[buffer[k]];
+    }
+#pragma omp barrier
+}
+
+// Rebuilds the lists if they are not valid or a boid has moved more than skin / 2. Called from inside the parallel region.
+template<class Layout>
+inline void update_verlet(VerletLists<Layout>& lists, const typename Layout::Storage& boids, int N) {
+    const int tid = omp_get_thread_num();
+    float max_sq = 0.0f;
+
+    if (lists.valid) {
+#pragma omp for schedule(static)
+        for (int i = 0; i < N; i++) {
+            const float dx = Layout::x(boids, i) - lists.x_ref[i];
+            const float dy = Layout::y(boids, i) - lists.y_ref[i];
+            float dist_sq = dx*dx + dy*dy;
+            if constexpr (Layout::D == 3) {
+                const float dz = Layout::z(boids, i) - lists.z_ref[i];
+                dist_sq += dz*dz;
+            }
+            max_sq = std::max(max_sq, dist_sq);
+        }
+    }
+    lists.thread_max[tid] = max_sq;
+
+#pragma omp barrier
+#pragma omp single
+    {
+        const float half_skin = 0.5f * lists.skin;
+        lists.rebuild = !lists.valid
+                        || *std::max_element(lists.thread_max.begin(), lists.thread_max.end()) > half_skin * half_skin;
+        lists.frames++;
+    }
+
+    if (lists.rebuild)
+        build_verlet(lists, boids, N);
+}
+
+template<class Layout>
+inline void print_verlet(const VerletLists<Layout>& lists, int N) {
+    if (lists.frames == 0)
+        return;
+
+    printf("Verlet lists: skin %.1f px, rebuilt %lld times in %lld frames (%.1f%%, every %.1f frames), %.1f candidates per boid\n",
+           lists.skin, lists.builds, lists.frames, 100.0 * lists.builds / lists.frames,
+           lists.builds > 0 ? (double)lists.frames / lists.builds : 0.0,
+           lists.builds > 0 ? (double)lists.candidates_built / ((double)lists.builds * N) : 0.0);
+}
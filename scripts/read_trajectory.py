@@ -0,0 +1,91 @@
+import struct
+import sys
+import zlib
+
+
+#Script to decode a trajectory written with --trajectory (format in headers/Trajectory_writer.h)
+#usage: python read_trajectory.py file.btraj            -> summary of the file
+#       python read_trajectory.py file.btraj out.csv    -> every recorded frame as frame,id,x,y,vx,vy
+
+HEADER = struct.Struct('<8sIIQIIff')
+BLOCK = struct.Struct('<QIIBB6x')
+
+
+def read_varints(data, count):
+    values = []
+    value = 0
+    shift = 0
+    for byte in data:
+        value |= (byte & 0x7F) << shift
+        shift += 7
+        if byte < 0x80:
+            values.append((value >> 1) ^ -(value & 1)) #zigzag back to signed
+            value = 0
+            shift = 0
+    if len(values) != count:
+        raise ValueError("corrupted block: %d values instead of %d" % (len(values), count))
+    return values
+
+
+def read_trajectory(path):
+    with open(path, 'rb') as f:
+        magic, version, header_size, n, every, keyframe_every, pos_scale, vel_scale = HEADER.unpack(f.read(HEADER.size))
+        if magic != b'BOIDTRAJ' or version != 1:
+            raise ValueError("not a trajectory file: " + path)
+        f.seek(header_size)
+
+        previous = None
+        while True:
+            raw_block = f.read(BLOCK.size)
+            if len(raw_block) < BLOCK.size:
+                break
+            frame, raw_size, stored_size, keyframe, compressed = BLOCK.unpack(raw_block)
+            payload = f.read(stored_size)
+            if compressed:
+                payload = zlib.decompress(payload)
+            if len(payload) != raw_size:
+                raise ValueError("corrupted block of frame %d" % frame)
+
+            deltas = read_varints(payload, 4 * n)
+            if keyframe or previous is None:
+                values = deltas
+            else:
+                values = [p + d for p, d in zip(previous, deltas)]
+            previous = values
+
+            #x of every boid, then y, vx, vy
+            x = [v / pos_scale for v in values[0:n]]
+            y = [v / pos_scale for v in values[n:2 * n]]
+            vx = [v / vel_scale for v in values[2 * n:3 * n]]
+            vy = [v / vel_scale for v in values[3 * n:4 * n]]
+            yield frame, stored_size, x, y, vx, vy
+
+
+def main():
+    if len(sys.argv) < 2:
+        print("usage: python read_trajectory.py file.btraj [out.csv]")
+        sys.exit(1)
+
+    out = open(sys.argv[2], 'w') if len(sys.argv) > 2 else None
+    if out:
+        out.write("frame,id,x,y,vx,vy\n")
+
+    frames = 0
+    stored = 0
+    first = last = None
+    for frame, stored_size, x, y, vx, vy in read_trajectory(sys.argv[1]):
+        frames += 1
+        stored += stored_size
+        first = frame if first is None else first
+        last = frame
+        if out:
+            for i in range(len(x)):
+                out.write("%d,%d,%.6f,%.6f,%.6f,%.6f\n" % (frame, i, x[i], y[i], vx[i], vy[i]))
+
+    if out:
+        out.close()
+    print("%d frames (%s to %s), %.2f MB of blocks" % (frames, first, last, stored / 1e6))
+
+
+if __name__ == "__main__":
+    main()
@@ -1,46 +1,40 @@
-import os
 import subprocess
 
 
-#Script to execute parallel versions we want to test.
+#Script to execute the benchmarks we want to test. The whole matrix runs in a single process of
+#Benchmark_sweep (one allocation per point, warm-up frames, one csv with its header), instead of
+#one launch of an executable per point.
 
-EXECUTABLES = {
-    "SOA_parallel_SIMD": "../cmake-build-benchmark/SOA_parallel_SIMD",
-}
+SWEEP_EXE = "../cmake-build-benchmark/Benchmark_sweep"
+
+LAYOUTS = ["SOA_parallel_SIMD"]  # AOS, AOS_parallel_SIMD, SOA, SOA_parallel_SIMD
 
 Boids_values = [1500,3000,6000,9000,12000]
 Threads_values = [1, 2, 4, 8]
+Weak_boids_per_thread = 1500  # weak scaling series, N = 1500 * threads (0 = no series)
 Frames = 300
+Warmup_frames = 10
 N_experiments = 6
 
 
 CSV_OUT = "SOA_parallel_SIMD.csv"
 
-def run_benchmarks(exe, n_boids, n_threads, csv):
-
-    env = os.environ.copy()
+def main():
 
     cmd = [
-        exe,
-        "--N", str(n_boids),
+        SWEEP_EXE,
+        "--layouts", ",".join(LAYOUTS),
+        "--N", ",".join(str(n) for n in Boids_values),
+        "--threads", ",".join(str(t) for t in Threads_values),
+        "--weak", str(Weak_boids_per_thread),
         "--frames", str(Frames),
-        "--threads", str(n_threads),
-        "--csv", str(csv)
+        "--warmup", str(Warmup_frames),
+        "--repeats", str(N_experiments),
+        "--csv", CSV_OUT,
     ]
 
-
-    subprocess.run(cmd, env=env, capture_output=True, text=True)
-
-def main():
-
-    with open(CSV_OUT, mode="w", newline="") as f:
-
-        for layout, exe in EXECUTABLES.items():
-            for n_boids in Boids_values:
-                for n_threads in Threads_values if layout != "Sequential" else [1]:
-                    for run_id in range(N_experiments):
-                        run_benchmarks(exe, n_boids, n_threads, CSV_OUT)
+    # The summary of every point is printed as the sweep goes
+    subprocess.run(cmd, check=True)
 
 if __name__ == "__main__":
     main()
-
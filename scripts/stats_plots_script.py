@@ -3,53 +3,46 @@ import matplotlib.pyplot as plt
 import numpy as np
 
 
-#Script to plot speedups from .csv
-def drop_first(group): #to drop the first execution and have a more reliable average
-    return group.iloc[1:]
+#Script to plot speedups from the .csv of Benchmark_sweep (written by run_benchmark.py): one header,
+#one row per repeat with layout, kernel, neighbours, scaling, N, threads, repeat, seed, frames, warmup, weak, time_ms, ...
 
 #results we want to compare
-data_seq = "./test_bench/seq.csv"
-data_SOA = "./test_bench/SOA_SIMD_noPadding_results.csv"
+data_sweep = "./test_bench/SOA_parallel_SIMD.csv"
+LAYOUT = "SOA_parallel_SIMD"
+BASELINE_LAYOUT = "SOA_parallel_SIMD" #its 1 thread times are the reference, e.g. "SOA" if it's in the sweep
 
 
-df_seq = pd.read_csv(data_seq, comment='#', header=None, names=['N', 'frames', 'threads', 'time_ms'])
-df_seq = df_seq[df_seq['N'] != 'N']
+def mean_times(df): #to drop the first repeat and have a more reliable average
+    df = df[df['repeat'] > 0]
+    return df.groupby(['N', 'threads'])['time_ms'].mean()
 
-df_seq = df_seq.astype({'N': int, 'frames': int, 'threads': int, 'time_ms': int})
 
-df_filtered_seq = df_seq.groupby('N', group_keys=False).apply(drop_first)
+df = pd.read_csv(data_sweep, header=0)
+df = df.astype({'N': int, 'threads': int, 'repeat': int, 'weak': int, 'time_ms': float})
+weak = df['weak'].iloc[0] if len(df) else 0 #boids per thread of the weak series, 0 = no series
 
-#averages for every different N value
-mean_times_seq = df_filtered_seq.groupby('N')['time_ms'].mean()
+df_layout = df[df['layout'] == LAYOUT]
+df_base = df[(df['layout'] == BASELINE_LAYOUT) & (df['threads'] == 1)]
 
-print("To visualize if averages have been properly calculated (sequential) (ms): ")
-print(mean_times_seq)
+#strong scaling: the "strong" rows. The weak points with N = weak * threads that are in the strong
+#series are written only once, as "strong" rows
+mean_times_strong = mean_times(df_layout[df_layout['scaling'] == 'strong'])
+mean_times_base = mean_times(df_base[df_base['scaling'] == 'strong']).droplevel('threads')
 
-df_AOS = pd.read_csv(data_SOA, comment='#', header=None, names=['N', 'frames', 'threads', 'time_ms'])
-df_AOS = df_AOS[df_AOS['N'] != 'N']
+print("To visualize if averages have been properly calculated (baseline, 1 thread) (ms): ")
+print(mean_times_base)
+print("To visualize if averages have been properly calculated (" + LAYOUT + ") (ms): ")
+print(mean_times_strong)
 
-df_AOS = df_AOS.astype({'N': int, 'frames': int, 'threads': int, 'time_ms': int})
 
-df_AOS['run_idx'] = df_AOS.groupby(['N', 'threads']).cumcount()
+speedup = {}
 
-df_filtered_AOS = df_AOS[df_AOS['run_idx'] > 0]
-
-#averages for every different N value
-mean_times_AOS = df_filtered_AOS.groupby(['N', 'threads'])['time_ms'].mean()
-
-
-print("To visualize if averages have been properly calculated (AOS) (ms): ")
-print(mean_times_AOS)
-
-
-speedup_AOS = {}
-
-for (N, threads), t_par in mean_times_AOS.items():
-    t_seq = mean_times_seq.loc[N]
-    speedup_AOS[(N, threads)] = t_seq / t_par
+for (N, threads), t_par in mean_times_strong.items():
+    if N in mean_times_base.index:
+        speedup[(N, threads)] = mean_times_base.loc[N] / t_par
 
 df_speedup = (
-    pd.Series(speedup_AOS)
+    pd.Series(speedup, dtype=float)
     .rename("speedup")
     .reset_index()
     .rename(columns={"level_0": "N", "level_1": "threads"})
@@ -58,6 +51,17 @@ df_speedup = (
 print("df check: ")
 print(df_speedup)
 
+#weak scaling: the "weak" rows plus the strong ones with N = weak * threads
+df_weak = df_layout[(df_layout['scaling'] == 'weak') | (df_layout['N'] == weak * df_layout['threads'])]
+mean_times_weak = mean_times(df_weak).droplevel('N') if weak > 0 else pd.Series(dtype=float)
+
+efficiency = pd.Series(dtype=float)
+if 1 in mean_times_weak.index:
+    efficiency = mean_times_weak.loc[1] / mean_times_weak
+
+print("weak scaling efficiency (" + str(weak) + " boids per thread): ")
+print(efficiency)
+
 #---------PLOTS---------
 
 plt.figure(figsize=(10,6))
@@ -73,10 +77,20 @@ plt.xlim(1400, 12100)
 plt.ylim(0, 10)
 plt.xlabel("N")
 plt.ylabel("Speed-up")
-plt.title("SOA_SIMD_noPadding_Reduction vs Sequential. 300 Frames")
+frames = df_layout['frames'].iloc[0] if len(df_layout) else 0
+plt.title(f"{LAYOUT} vs {BASELINE_LAYOUT} (1 thread). {frames} Frames")
 plt.legend()
 
 plt.grid(True)
 
-plt.show()
+if len(efficiency):
+    plt.figure(figsize=(10,6))
+    plt.plot(efficiency.index, efficiency.values, marker="o")
+    plt.xticks(efficiency.index)
+    plt.ylim(0, 1.1)
+    plt.xlabel("threads")
+    plt.ylabel("Efficiency")
+    plt.title(f"{LAYOUT} weak scaling, {weak} boids per thread. {frames} Frames")
+    plt.grid(True)
 
+plt.show()